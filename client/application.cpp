@@ -5,8 +5,13 @@
 #include <future>
 #include <thread>
 #include <fstream>
+#include <algorithm>
+#include <chrono>
 
 #include "client.hpp"
+#include "replay.hpp"
+#include "udprate.hpp"
+#include "muxconnection.hpp"
 
 
 // Function declaration
@@ -16,51 +21,195 @@
  * The function is responsible for asking the user for the necessary information to start the client(s)
  * and will error check the input before returning the data. It will return the number of client to create via the arguments
  * and will return a serverInfo struct with the server address, port number and selection.
+ * The address isn't asked for when the requests go through shared memory.
  * 
  * @param int&
+ * @param bool
  * @return serverInfo
  */
-serverInfo getUserInput(int& numClients);
+serverInfo getUserInput(int& numClients, bool askAddress = true);
 
+/**
+ * The getServerAddress function asks the user for the server address and port number and
+ * stores them in the given serverInfo struct along with the addresses they resolve to. It returns nothing.
+ * An address starting with '/' is a Unix domain socket path and needs no port.
+ * 
+ * @param serverInfo&
+ * @return void
+ */
+void getServerAddress(serverInfo& info);
+
+/**
+ * The clientResult struct is what every client task hands back to the main thread.
+ */
+struct clientResult {
+
+    double turnAround; // ms
+    std::chrono::steady_clock::time_point firstByte;
+    connectionPhases phases;
+};
 
 
-int main()
+int main(int argc, char** argv)
 {
     // Initialize variables
     int numberOfClients;
     double totalTime = 0;
     serverInfo server;
     std::vector<double> dataPoints;
-    std::vector<std::future<double>> futures;
+    std::vector<clientResult> results;
+    std::vector<std::future<clientResult>> futures;
+    bool waitForServer = false;
+    bool keepAlive = false;
+    int rounds = 1;
+    std::string replayPath;
+    double replaySpeed = 1.0;
+    std::string ringName;
+    double udpSeconds = 0;
+    ConnectionPool pool;
+    std::unique_ptr<ShmTransport> shm;
+    bool multiplex = false;
+    std::unique_ptr<MuxConnection> mux;
+
+    // --wait-for-server starts the clients alongside a restarting server and measures how fast it gets hot
+    // --keep-alive reuses connections between clients, --rounds sends the burst of clients that many times
+    // --shm sends the requests through the server's shared memory ring instead of a socket
+    // --udp measures the request rate of the server's datagram port for that many seconds
+    // --multiplex sends every client's request on one shared connection, answered out of order
+    // --replay re-issues a trace recorded by the server, --speed scales its timing
+    for(int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if(arg == "--wait-for-server")
+            waitForServer = true;
+        else if(arg == "--keep-alive")
+            keepAlive = true;
+        else if(arg == "--rounds" && i + 1 < argc)
+            rounds = std::max(1, atoi(argv[++i]));
+        else if(arg == "--shm")
+            ringName = i + 1 < argc && argv[i + 1][0] == '/' ? argv[++i] : "/cnt4504_ring";
+        else if(arg == "--udp")
+            udpSeconds = i + 1 < argc && isdigit(argv[i + 1][0]) ? std::max(0.1, atof(argv[++i])) : 5.0;
+        else if(arg == "--multiplex")
+            multiplex = true;
+        else if(arg == "--replay" && i + 1 < argc)
+            replayPath = argv[++i];
+        else if(arg == "--speed" && i + 1 < argc)
+            replaySpeed = atof(argv[++i]);
+        else
+        {
+            std::cerr << "[ERROR]: Unknown option " << arg << '\n'
+                      << "Usage: " << argv[0] << " [--wait-for-server] [--keep-alive] [--rounds <n>] [--shm [ring]] [--udp [seconds]] [--multiplex] [--replay <trace> [--speed <factor>]]\n";
+            return 0;
+        }
+    }
+
+    // mapped once, every client thread publishes into the same ring
+    if(!ringName.empty())
+    {
+        shm = std::make_unique<ShmTransport>(ringName);
+        server.shm = shm.get();
+    }
+
+    if(!replayPath.empty())
+    {
+        if(!shm)
+            getServerAddress(server);
+        if(keepAlive)
+            server.pool = &pool;
+        if(multiplex && !shm)
+        {
+            mux = std::make_unique<MuxConnection>(server);
+            server.mux = mux.get();
+        }
+        replayTrace(server, replayPath, replaySpeed > 0 ? replaySpeed : 1.0);
+        return 0;
+    }
 
     // Ask user for input
-    server = getUserInput(numberOfClients);
+    server = getUserInput(numberOfClients, !shm);
+    if(udpSeconds > 0)
+    {
+        measureUdpRate(server, numberOfClients, udpSeconds);
+        return 0;
+    }
+
+    server.shm = shm.get();
+    server.waitForServer = waitForServer;
+    if(keepAlive)
+        server.pool = &pool;
+    if(multiplex && !shm)
+    {
+        // opened once, the clients share it the way they would share a pooled connection
+        mux = std::make_unique<MuxConnection>(server);
+        server.mux = mux.get();
+        sscout << "Multiplexing every request on one connection, " << mux->GetMaxInFlight() << " in flight at most.\n";
+    }
+    auto launchTime = std::chrono::steady_clock::now();
 
     // Reserve space for async
     futures.reserve(numberOfClients);
 
-    // Spawn tasks
     sscout << "\nMain Thread ID: " << std::this_thread::get_id() << '\n';
-    for (int i = 0; i < numberOfClients; i++)
+    for(int round = 0; round < rounds; round++)
     {
-        futures.emplace_back(std::async(std::launch::async, [&server]() -> double
+        // Spawn tasks
+        futures.clear();
+        for (int i = 0; i < numberOfClients; i++)
+        {
+            futures.emplace_back(std::async(std::launch::async, [&server]() -> clientResult
+            {
+                Client client(server);
+                return { client.GetTimer().GetDurationMicro().count() * 0.001, client.GetFirstByteTime(), client.GetPhases() };
+            }));
+        }
+        sscout << "\n\nFinished launching threads.\n";
+
+        // Wait for all tasks to finish and get total turn-around time
+        for(int i = 0; i < futures.size(); i++)
         {
-            Client client(server);
-            return client.GetTimer().GetDurationMicro().count() * 0.001;
-        }));
+            results.push_back(futures[i].get());
+            dataPoints.push_back(results.back().turnAround);
+            totalTime += dataPoints.back();
+        }
     }
-    sscout << "\n\nFinished launching threads.\n";
+    double wallTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - launchTime).count();
 
-    // Wait for all tasks to finish and get total turn-around time
-    for(int i = 0; i < futures.size(); i++)
+    // where the time went, to tell connection set up apart from the server's work
+    std::vector<double> connectTimes, firstByteTimes, transferTimes;
+    for(const clientResult& r : results)
     {
-        dataPoints.push_back(futures[i].get());
-        totalTime += dataPoints[i];
+        connectTimes.push_back(r.phases.connect);
+        firstByteTimes.push_back(r.phases.firstByte);
+        transferTimes.push_back(r.phases.transfer);
     }
 
     sscout << "\n------------------------------------------------------------------------------\n"
               << "The total turn-around time: " << totalTime << " ms\n"
-              << "The average turn-around time: " << totalTime/numberOfClients << " ms\n" << std::endl;
+              << "The average turn-around time: " << totalTime/dataPoints.size() << " ms\n"
+              << "The p50 / p99 turn-around time: " << percentile(dataPoints, 50) << " / " << percentile(dataPoints, 99) << " ms\n"
+              << "The p50 / p99 connect time: " << percentile(connectTimes, 50) << " / " << percentile(connectTimes, 99) << " ms\n"
+              << "The p50 / p99 time to first byte: " << percentile(firstByteTimes, 50) << " / " << percentile(firstByteTimes, 99) << " ms\n"
+              << "The p50 / p99 transfer time: " << percentile(transferTimes, 50) << " / " << percentile(transferTimes, 99) << " ms\n"
+              << "Throughput: " << dataPoints.size() / wallTime << " requests/s\n" << std::endl;
+
+    if(server.waitForServer)
+    {
+        // startup-to-first-byte is measured from launch, which is when the server was restarted
+        auto firstByte = std::min_element(results.begin(), results.end(),
+            [](const clientResult& a, const clientResult& b){ return a.firstByte < b.firstByte; })->firstByte;
+
+        std::vector<double> firstSecond;
+        for(const clientResult& r : results)
+        {
+            if(r.firstByte - firstByte <= std::chrono::seconds(1))
+                firstSecond.push_back(r.turnAround);
+        }
+
+        sscout << "Startup to first byte: " << std::chrono::duration<double, std::milli>(firstByte - launchTime).count() << " ms\n"
+               << "First second p99 turn-around time: " << percentile(firstSecond, 99) << " ms ("
+               << firstSecond.size() << " requests)\n" << std::endl;
+    }
 
     // Append data to file 
     std::ofstream fileOut;
@@ -70,24 +219,36 @@ int main()
     {
         fileOut << d << ", ";
     }
-    fileOut << totalTime << ", " << totalTime/numberOfClients << "\n";
+    fileOut << totalTime << ", " << totalTime/dataPoints.size() << "\n";
     fileOut.close();
 
     return 0;
 }
 
 // Function definitions
-serverInfo getUserInput(int& numClients)
+void getServerAddress(serverInfo& info)
 {
-    serverInfo info;
-    
     // Get server address
     std::cout << "Please input the server address: ";
     std::cin >> info.serverAddress;
 
-    // Get port number
-    std::cout << "Please enter the port which the server is listening on: ";
-    std::cin >> info.portNumber;
+    // Get port number, a Unix domain socket has none
+    info.portNumber = 0;
+    if(info.serverAddress[0] != '/')
+    {
+        std::cout << "Please enter the port which the server is listening on: ";
+        std::cin >> info.portNumber;
+    }
+
+    // resolved once here, the client threads connect to the stored addresses
+    resolveServer(info);
+}
+
+serverInfo getUserInput(int& numClients, bool askAddress)
+{
+    serverInfo info;
+    if(askAddress)
+        getServerAddress(info);
 
     // Get user selection
     std::cout << "Here are the services that can be requested from the server: \n" 
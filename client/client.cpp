@@ -1,4 +1,90 @@
 #include "client.hpp"
+#include "muxconnection.hpp"
+
+namespace
+{
+    double elapsedMilli(std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to)
+    {
+        return std::chrono::duration<double, std::milli>(to - from).count();
+    }
+}
+
+void resolveServer(serverInfo& info)
+{
+    info.addresses.clear();
+    if(info.serverAddress[0] == '/')
+    {
+        resolvedAddress address;
+        sockaddr_un& unixAddress = reinterpret_cast<sockaddr_un&>(address.address);
+        memset(&unixAddress, 0, sizeof(unixAddress));
+        if(info.serverAddress.size() >= sizeof(unixAddress.sun_path))
+        {
+            std::cerr << "Error getting host: socket path too long" << std::endl;
+            exit(0);
+        }
+
+        unixAddress.sun_family = AF_UNIX;
+        memcpy(unixAddress.sun_path, info.serverAddress.c_str(), info.serverAddress.size());
+        address.family = AF_UNIX;
+        address.length = offsetof(sockaddr_un, sun_path) + info.serverAddress.size() + 1;
+        info.addresses.push_back(address);
+        return;
+    }
+
+    // IPv4 or IPv6, whatever the name resolves to
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    addrinfo* results;
+    int status = getaddrinfo(info.serverAddress.c_str(), std::to_string(info.portNumber).c_str(), &hints, &results);
+    if(status != 0)
+    {
+        std::cerr << "Error getting host: " << gai_strerror(status) << std::endl;
+        exit(0);
+    }
+
+    for(addrinfo* result = results; result; result = result->ai_next)
+    {
+        resolvedAddress address;
+        address.family = result->ai_family;
+        address.length = result->ai_addrlen;
+        memcpy(&address.address, result->ai_addr, result->ai_addrlen);
+        info.addresses.push_back(address);
+    }
+    freeaddrinfo(results);
+}
+
+int connectToServer(const serverInfo& info)
+{
+    while(true)
+    {
+        // Attempt to connect to each address the server resolved to
+        int status = -1;
+        for(const resolvedAddress& address : info.addresses)
+        {
+            int serverID = socket(address.family, SOCK_STREAM, 0);
+            CHK_ERR(serverID, "Creating a socket")
+
+            status = connect(serverID, (const sockaddr*)&address.address, address.length);
+            if(status == 0)
+                return serverID;
+
+            // a failed socket can't be reused, keep errno for the error check below
+            int connectErrno = errno;
+            close(serverID);
+            errno = connectErrno;
+        }
+
+        // the server isn't listening yet, start over
+        if(!(errno == ECONNREFUSED && info.waitForServer))
+        {
+            CHK_ERR(status, "Connecting to server")
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
 
 Client::Client(const serverInfo& servInfo)
     : m_ServerInfo(servInfo) 
@@ -6,74 +92,121 @@ Client::Client(const serverInfo& servInfo)
     // empty message buffer
     m_MsgBuffer.fill('\0');
 
-    // Create the socket for us to bind to later
-    m_ServerID = socket(AF_INET, SOCK_STREAM, 0);
-    CHK_ERR(m_ServerID, "Creating a socket")
+    // Each client will hold their own Timer object and will be timing the Turn-around time,
+    // from opening the connection until the last byte of the response.
+    m_Timer.StartTimer();
+    auto start = std::chrono::steady_clock::now();
 
-    // Get the proper address resolved and attempts to open a connection
-    OpenConnection();
+    auto connected = start;
+    bool answered = true;
+    if(m_ServerInfo.shm)
+    {
+        // nothing to connect, the ring is mapped once for every client
+        RequestShm();
+    }
+    else if(m_ServerInfo.mux)
+    {
+        // the connection is shared and already open
+        RequestMux();
+    }
+    else
+    {
+        // Take a pooled connection or open a new one
+        bool reused = OpenConnection();
+        connected = std::chrono::steady_clock::now();
+        m_FirstByteTime = connected; // until the response starts, no first byte if it never does
 
-    // Now we are ready to send and receive data
-    // Each client will hold their own Timer object and will be timing the Turn-around time.
-    m_Timer.StartTimer();
-    SendAndRecv();
+        // Now we are ready to send and receive data
+        answered = SendAndRecv();
+        if(!answered && reused)
+        {
+            // the server dropped the idle connection, start over on a fresh one
+            close(m_ServerID);
+            Connect();
+            connected = std::chrono::steady_clock::now();
+            m_FirstByteTime = connected;
+            answered = SendAndRecv();
+        }
+    }
+    auto done = std::chrono::steady_clock::now();
     m_Timer.StopTimer();
 
-    sscout << "Thread ID: " << std::this_thread::get_id() << '\n'
-           << "Server: \n"
-           << &m_MsgBuffer[0] << '\n'
-           << "\nThe turn-around time was: " << m_Timer.GetDurationMicro().count() * 0.001 << " milliseconds." 
-           << "\n------------------------------------------------------------------------------\n" << std::endl;
+    m_Phases.connect = elapsedMilli(start, connected);
+    m_Phases.firstByte = elapsedMilli(connected, m_FirstByteTime);
+    m_Phases.transfer = elapsedMilli(m_FirstByteTime, done);
+
+    if(!m_ServerInfo.quiet && !answered)
+    {
+        sscout << "Thread ID: " << std::this_thread::get_id() << '\n'
+               << "The server closed the connection without answering."
+               << "\n------------------------------------------------------------------------------\n" << std::endl;
+    }
+    else if(!m_ServerInfo.quiet)
+    {
+        sscout << "Thread ID: " << std::this_thread::get_id() << '\n'
+               << "Server: \n"
+               << &m_MsgBuffer[0] << '\n'
+               << "\nThe turn-around time was: " << m_Timer.GetDurationMicro().count() * 0.001 << " milliseconds." 
+               << "\nConnect: " << m_Phases.connect << " ms, first byte: " << m_Phases.firstByte
+               << " ms, transfer: " << m_Phases.transfer << " ms."
+               << "\n------------------------------------------------------------------------------\n" << std::endl;
+    }
 
-    // Close the socket fd
-    close(m_ServerID);    
+    // Keep the connection for the next client or close the socket fd
+    if(m_ServerInfo.shm || m_ServerInfo.mux)
+        return;
+    if(m_ServerInfo.pool && m_Complete)
+        m_ServerInfo.pool->Release(m_ServerID);
+    else
+        close(m_ServerID);
 }
 
 Client::~Client()
 {}
 
 Timer Client::GetTimer() { return m_Timer; }
+std::chrono::steady_clock::time_point Client::GetFirstByteTime() { return m_FirstByteTime; }
+connectionPhases Client::GetPhases() { return m_Phases; }
 
-void Client::OpenConnection()
+bool Client::OpenConnection()
 {
-    // Clear the uninitialized memory
-    memset(&m_ServerAddress, 0, sizeof(m_ServerAddress));
-
-    // Set the sockaddr fields
-    m_ServerAddress.sin_family = AF_INET;
-    m_ServerAddress.sin_port = htons(m_ServerInfo.portNumber);
-
-    // call gethostbyname to get the correct hint to attach to sockaddr_in
-    hostent* hostQuery = gethostbyname(m_ServerInfo.serverAddress.c_str());
-    if(!hostQuery)
+    if(m_ServerInfo.pool)
     {
-        std::cerr << "Error getting host";
-        exit(0);
+        m_ServerID = m_ServerInfo.pool->Acquire();
+        if(m_ServerID >= 0)
+            return true;
     }
-    
-    // copy the data over to the sockaddr
-    memcpy(&m_ServerAddress.sin_addr.s_addr, hostQuery->h_addr_list[0], hostQuery->h_length);
 
-    // Attempt to connect to the server
-    CHK_ERR(connect(m_ServerID, (sockaddr*)&m_ServerAddress,
-     sizeof(m_ServerAddress)), "Connecting to server")
+    Connect();
+    return false;
 }
 
-void Client::SendAndRecv()
+void Client::Connect()
+{
+    m_ServerID = connectToServer(m_ServerInfo);
+}
+
+bool Client::SendAndRecv()
 {
     // Declare and initialize local variables
     int totalBytes = 0, expectedBytes = 0;
+    int request = m_ServerInfo.pool ? m_ServerInfo.userSelection | KEEP_ALIVE_FLAG : m_ServerInfo.userSelection;
 
-    // Send client request code to server
-    m_NumBytes = write(m_ServerID, &m_ServerInfo.userSelection, sizeof(m_ServerInfo.userSelection));
+    // Send client request code to server, a dropped pooled connection must not raise SIGPIPE
+    m_NumBytes = send(m_ServerID, &request, sizeof(request), MSG_NOSIGNAL);
+    if(m_NumBytes < 0 && (errno == EPIPE || errno == ECONNRESET))
+        return false;
     CHK_ERR(m_NumBytes, "Sending a message to server")
     const int sent = m_NumBytes;
 
     /// Read the number of bytes that the client should expect to recv
     m_NumBytes = read(m_ServerID, &expectedBytes, sizeof(expectedBytes));
+    if(m_NumBytes == 0 || (m_NumBytes < 0 && errno == ECONNRESET))
+        return false;
     CHK_ERR(m_NumBytes, "Receiving data size")
+    m_FirstByteTime = std::chrono::steady_clock::now();
 
-    do
+    while(totalBytes < expectedBytes) // Check to see if we recieved all data after one recv() call
     {
         // Get m_NumBytes from server via TCP buffer
         m_NumBytes = read(m_ServerID, &m_MsgBuffer[totalBytes], m_MsgBuffer.size() -  totalBytes - 1);
@@ -86,8 +219,41 @@ void Client::SendAndRecv()
         {
             totalBytes += m_NumBytes; // Still data left in the buffer
         }
-    } while(totalBytes < expectedBytes); // Check to see if we recieved all data after one recv() call
+    }
+    m_Complete = totalBytes == expectedBytes;
     
-    sscout << "Bytes sent: " << m_NumBytes << '\n'
-           << "Bytes recieved: " << totalBytes << '\n';
-}
\ No newline at end of file
+    if(!m_ServerInfo.quiet)
+    {
+        sscout << "Bytes sent: " << sent << '\n'
+               << "Bytes recieved: " << totalBytes << '\n';
+    }
+    return true;
+}
+
+void Client::RequestShm()
+{
+    const int selection = m_ServerInfo.userSelection;
+    if(selection < 1 || selection > SHARED_NUM_SLOTS)
+    {
+        // the server would only answer with an error, don't bother it
+        m_FirstByteTime = std::chrono::steady_clock::now();
+        snprintf(&m_MsgBuffer[0], m_MsgBuffer.size() - 1, "ERROR: invalid selection.");
+        return;
+    }
+
+    m_ServerInfo.shm->WaitDone(m_ServerInfo.shm->Publish(selection));
+    m_FirstByteTime = std::chrono::steady_clock::now();
+    int totalBytes = m_ServerInfo.shm->ReadResponse(selection, &m_MsgBuffer[0], m_MsgBuffer.size());
+
+    if(!m_ServerInfo.quiet)
+        sscout << "Bytes recieved: " << totalBytes << '\n';
+}
+
+void Client::RequestMux()
+{
+    int totalBytes = m_ServerInfo.mux->Request(m_ServerInfo.userSelection, &m_MsgBuffer[0], m_MsgBuffer.size(), m_FirstByteTime);
+    CHK_ERR(totalBytes, "Receiving a multiplexed response")
+
+    if(!m_ServerInfo.quiet)
+        sscout << "Bytes recieved: " << totalBytes << '\n';
+}
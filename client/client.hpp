@@ -8,17 +8,39 @@
 #include <sys/types.h> // recommended by man
 #include <netinet/in.h> // struct sockaddr_in
 #include <string.h> // memset(), memcpy()
-#include <netdb.h> // hostent
+#include <netdb.h> // getaddrinfo()
+#include <sys/un.h> // sockaddr_un
+#include <stddef.h> // offsetof
 
 #include <iostream>
 #include <string>
 #include <array>
 #include <memory>
 #include <thread>
+#include <chrono>
+#include <vector>
 
 #include "timer.hpp"
+#include "connectionpool.hpp"
+#include "shmtransport.hpp"
 #include "asyncstream.h"
 
+class MuxConnection;
+
+/**
+ * The resolvedAddress struct is one address the server name resolved to, in a form that can be handed
+ * straight to socket() and connect().
+ */
+struct resolvedAddress {
+
+    int family; // AF_INET, AF_INET6 or AF_UNIX
+    socklen_t length;
+    sockaddr_storage address;
+};
+
+// set in the selection to ask the server to keep the connection open, kept in sync with server/server.hpp
+constexpr int KEEP_ALIVE_FLAG = 0x100;
+
 /**
  * The serverInfo struct is a struct that contains  different variables used in
  * the identification and creation of the client. Specifically the information necessary to conn
@@ -30,9 +52,46 @@ struct serverInfo {
 
     std::string serverAddress;
     int portNumber;
+    std::vector<resolvedAddress> addresses; // filled once by resolveServer, tried in order
     int userSelection;
+    ConnectionPool* pool = nullptr; // reuse keep-alive connections from this pool, null to connect every time
+    ShmTransport* shm = nullptr; // send requests through the server's shared memory ring instead of a socket
+    MuxConnection* mux = nullptr; // send requests on this shared multiplexed connection instead of their own
+    bool waitForServer = false; // keep retrying refused connections until the server is up
+    bool quiet = false; // don't print the server's response, used when replaying thousands of requests
+};
+
+/**
+ * The connectionPhases struct breaks the turn-around time of a request down, all times are in milliseconds.
+ */
+struct connectionPhases {
+
+    double connect; // opening the connection, or taking one from the pool, 0 over shared memory or multiplexed
+    double firstByte; // connected until the response length arrived, this includes the server's work
+    double transfer; // first byte until the last byte of the response, the copy out of the shared cache
 };
 
+/**
+ * The resolveServer function looks the server address up with getaddrinfo and stores every IPv4 and IPv6
+ * address it resolves to in the serverInfo struct, so the clients don't each resolve it again.
+ * An address starting with '/' is the path of the server's Unix domain socket instead.
+ * It exits if the address can't be resolved.
+ *
+ * @param serverInfo&
+ * @return void
+ */
+void resolveServer(serverInfo& info);
+
+/**
+ * The connectToServer function tries the resolved addresses in order until one accepts the connection and
+ * returns the connected socket. If waitForServer is set a refused connection is retried until the server listens.
+ * It exits if none of the addresses can be connected to.
+ *
+ * @param info
+ * @return int
+ */
+int connectToServer(const serverInfo& info);
+
 /**
  * The CHK_ERR macro is used to use preprocessor to write the socket error checking code by 
  * wrapping the first argument up in an if and second argument to output error message.
@@ -58,8 +117,8 @@ public:
     /**
      * The Client constructor accepts a serverInfo structure that contains the necessary data to
      * create a socket and Open a connection to the server. The moment the object gets created is the moment
-     * the client attempts to open a connection. Once its open a connection it will time the send and recv 
-     * turn around time.
+     * the client attempts to open a connection. The turn-around time is timed from opening the connection
+     * until the last byte of the response, and broken down into phases.
      * 
      * @param servInfo
      */
@@ -81,40 +140,87 @@ public:
      */
     Timer GetTimer();
 
+    /**
+     * The GetFirstByteTime public member function returns the steady clock time point at which the first
+     * byte of the response was received. It is used to measure how long a restarted server takes to answer.
+     *
+     * @param void
+     * @return std::chrono::steady_clock::time_point
+     */
+    std::chrono::steady_clock::time_point GetFirstByteTime();
+
+    /**
+     * The GetPhases public member function returns how the turn-around time was spent.
+     *
+     * @param void
+     * @return connectionPhases
+     */
+    connectionPhases GetPhases();
+
 private:
     // private methods
 
     /**
-     * OpenConnection is a private member function that accepts zero arguments and returns nothing.
-     * The function will try to access databases to resolve the proper sockaddr and then attempt to 
-     * connect to the server.
+     * OpenConnection is a private member function that takes an idle connection from the pool if there is one,
+     * otherwise it connects to the server. It returns true if the connection came from the pool.
+     * 
+     * @param void
+     * @return bool
+     */
+    bool OpenConnection();
+
+    /**
+     * Connect is a private member function that accepts zero arguments and returns nothing.
+     * It opens a new connection to the server with connectToServer.
      * 
      * @param void
      * @return void
-     * @see connect() in socket.h
+     * @see connectToServer
      */
-    void OpenConnection();
+    void Connect();
 
     /**
      * SendAndRecv is a private member function that will hold the code necessary to send and recieve data
-     * from the open connection. The function accepts zero arguments and returns nothing.
+     * from the open connection. It returns false if the connection was closed before the response started,
+     * which happens when the server dropped an idle pooled connection.
      * 
      * @param void
-     * @return void
+     * @return bool
      * @see OpenConnection
      */
-    void SendAndRecv();
+    bool SendAndRecv();
+
+    /**
+     * RequestShm is a private member function that sends the request through the shared memory ring and
+     * copies the response out of the shared cache.
+     *
+     * @param void
+     * @return void
+     */
+    void RequestShm();
+
+    /**
+     * RequestMux is a private member function that sends the request on the shared multiplexed connection
+     * and waits for the answer with its id.
+     *
+     * @param void
+     * @return void
+     */
+    void RequestMux();
 
 
 private:
     // Private member variables
     serverInfo m_ServerInfo;
     Timer m_Timer;
+    std::chrono::steady_clock::time_point m_FirstByteTime;
+    connectionPhases m_Phases;
 
     int m_ServerID;
     int m_NumBytes;
-    sockaddr_in m_ServerAddress;
-    std::array<char, 1024 * 24> m_MsgBuffer;
+    bool m_Complete = false; // the whole response was read, so the connection can be reused
+    std::array<char, 1024 * 32> m_MsgBuffer; // the server's largest response
+
 };
 
 #endif //CLIENT_H
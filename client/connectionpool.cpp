@@ -0,0 +1,38 @@
+#include "connectionpool.hpp"
+
+ConnectionPool::ConnectionPool(size_t maxIdle)
+    : m_MaxIdle(maxIdle)
+{
+    m_Idle.reserve(maxIdle);
+}
+
+ConnectionPool::~ConnectionPool()
+{
+    for(int fd : m_Idle)
+        close(fd);
+}
+
+int ConnectionPool::Acquire()
+{
+    std::lock_guard<std::mutex> lock(m_Lock);
+    if(m_Idle.empty())
+        return -1;
+
+    // most recently used first, it is the least likely to have been dropped by the server
+    int fd = m_Idle.back();
+    m_Idle.pop_back();
+    return fd;
+}
+
+void ConnectionPool::Release(int fd)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_Lock);
+        if(m_Idle.size() < m_MaxIdle)
+        {
+            m_Idle.push_back(fd);
+            return;
+        }
+    }
+    close(fd);
+}
@@ -0,0 +1,55 @@
+#ifndef CONNECTIONPOOL_HPP
+#define CONNECTIONPOOL_HPP
+
+#include <unistd.h> // close()
+#include <mutex>
+#include <vector>
+
+/**
+ * The ConnectionPool class keeps the keep-alive connections of finished clients open so the next client
+ * can send its request on one of them instead of connecting again. It is shared by every client thread.
+ */
+class ConnectionPool
+{
+public:
+    /**
+     * The ConnectionPool constructor accepts the most idle connections it will hold on to.
+     *
+     * @param maxIdle
+     */
+    ConnectionPool(size_t maxIdle = 128);
+
+    /**
+     * The ConnectionPool destructor closes the idle connections.
+     *
+     * @param void
+     */
+    ~ConnectionPool();
+
+    ConnectionPool(const ConnectionPool&) = delete;
+    ConnectionPool& operator=(const ConnectionPool&) = delete;
+
+    /**
+     * Acquire takes an idle connection out of the pool. It returns -1 if there is none.
+     *
+     * @param void
+     * @return int
+     */
+    int Acquire();
+
+    /**
+     * Release hands a connection whose response was read completely back to the pool.
+     * It is closed instead if the pool is full.
+     *
+     * @param fd
+     * @return void
+     */
+    void Release(int fd);
+
+private:
+    std::mutex m_Lock;
+    std::vector<int> m_Idle;
+    size_t m_MaxIdle;
+};
+
+#endif // CONNECTIONPOOL_HPP
@@ -0,0 +1,143 @@
+#include "muxconnection.hpp"
+
+namespace
+{
+    // reads exactly size bytes, false if the connection closed or broke first
+    bool readExact(int fd, void* buffer, size_t size)
+    {
+        size_t total = 0;
+        while(total < size)
+        {
+            ssize_t numBytes = read(fd, static_cast<char*>(buffer) + total, size - total);
+            if(numBytes < 0 && errno == EINTR)
+                continue;
+            if(numBytes <= 0)
+                return false;
+            total += numBytes;
+        }
+        return true;
+    }
+}
+
+MuxConnection::MuxConnection(const serverInfo& server)
+{
+    m_ServerID = connectToServer(server);
+
+    // requests from different threads are small separate writes, Nagle would hold each back until the last is acked
+    int enable = 1;
+    setsockopt(m_ServerID, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+
+    muxHello hello;
+    memcpy(hello.magic, MUX_MAGIC, sizeof(MUX_MAGIC));
+    hello.version = MUX_VERSION;
+    int numBytes = send(m_ServerID, &hello, sizeof(hello), MSG_NOSIGNAL);
+    CHK_ERR(numBytes, "Sending the protocol hello")
+
+    // a server without the multiplexed protocol answers the hello as an invalid selection
+    muxAccept accept;
+    if(!readExact(m_ServerID, &accept, sizeof(accept)) || memcmp(accept.hello.magic, MUX_MAGIC, sizeof(MUX_MAGIC)) != 0
+       || accept.hello.version == 0 || accept.maxInFlight == 0)
+    {
+        std::cerr << "[ERROR]: The server doesn't speak the multiplexed protocol.\n";
+        exit(0);
+    }
+    m_MaxInFlight = accept.maxInFlight;
+
+    m_Reader = std::thread(&MuxConnection::ReadResponses, this);
+}
+
+MuxConnection::~MuxConnection()
+{
+    // wakes the reader thread
+    shutdown(m_ServerID, SHUT_RDWR);
+    m_Reader.join();
+    close(m_ServerID);
+}
+
+uint32_t MuxConnection::GetMaxInFlight() { return m_MaxInFlight; }
+
+int MuxConnection::Request(int selection, char* buffer, size_t size, std::chrono::steady_clock::time_point& firstByte)
+{
+    pendingRequest pending;
+    pending.buffer = buffer;
+    pending.size = size;
+
+    // the server wouldn't read a request past its limit anyway, wait for a slot here instead of in its socket buffer
+    muxRequest request;
+    std::unique_lock<std::mutex> lock(m_Lock);
+    m_SlotFree.wait(lock, [this]() { return m_Broken || m_InFlight < m_MaxInFlight; });
+    if(m_Broken)
+        return -1;
+
+    m_InFlight++;
+    request.id = m_NextID++;
+    request.selection = selection;
+    m_Pending[request.id] = &pending;
+    lock.unlock();
+
+    {
+        std::lock_guard<std::mutex> writeLock(m_WriteLock);
+        if(send(m_ServerID, &request, sizeof(request), MSG_NOSIGNAL) < 0)
+            shutdown(m_ServerID, SHUT_RDWR); // the reader fails every pending request
+    }
+
+    lock.lock();
+    pending.answered.wait(lock, [&pending]() { return pending.done; });
+    m_InFlight--;
+    m_SlotFree.notify_one();
+
+    firstByte = pending.firstByte;
+    return pending.length;
+}
+
+void MuxConnection::ReadResponses()
+{
+    std::array<char, 1024 * 32> discard;
+    muxResponse response;
+    while(readExact(m_ServerID, &response, sizeof(response)))
+    {
+        auto firstByte = std::chrono::steady_clock::now();
+        pendingRequest* pending;
+        {
+            std::lock_guard<std::mutex> lock(m_Lock);
+            auto found = m_Pending.find(response.id);
+            pending = found != m_Pending.end() ? found->second : nullptr;
+        }
+
+        // the requesting thread sleeps until done is set, so the output can go straight into its buffer
+        int length = std::max(response.length, 0);
+        size_t kept = pending ? std::min(size_t(length), pending->size - 1) : 0;
+        if(pending && !readExact(m_ServerID, pending->buffer, kept))
+            break;
+
+        // an answer bigger than the buffer, or to an id nobody sent, is read and dropped
+        for(size_t left = length - kept; left > 0; )
+        {
+            size_t chunk = std::min(left, discard.size());
+            if(!readExact(m_ServerID, &discard[0], chunk))
+                break;
+            left -= chunk;
+        }
+        if(!pending)
+            continue;
+
+        pending->buffer[kept] = '\0';
+        std::lock_guard<std::mutex> lock(m_Lock);
+        pending->length = kept;
+        pending->firstByte = firstByte;
+        pending->done = true;
+        pending->answered.notify_one();
+        m_Pending.erase(response.id);
+    }
+
+    // the connection is gone, nobody waiting will get an answer
+    std::lock_guard<std::mutex> lock(m_Lock);
+    m_Broken = true;
+    for(auto& [id, pending] : m_Pending)
+    {
+        pending->done = true;
+        pending->answered.notify_one();
+    }
+    m_Pending.clear();
+    m_SlotFree.notify_all();
+}
@@ -0,0 +1,131 @@
+#ifndef MUXCONNECTION_HPP
+#define MUXCONNECTION_HPP
+
+#include <netinet/tcp.h> // TCP_NODELAY
+#include <stdint.h> // fixed width integers
+#include <stddef.h> // size_t
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#include "client.hpp"
+
+/**
+ * The mux structs are the server's multiplexed protocol, see server/server.hpp.
+ * They have to be kept in sync with the server.
+ */
+struct muxHello {
+
+    char magic[3]; // MUX_MAGIC
+    uint8_t version;
+};
+
+struct muxAccept {
+
+    muxHello hello; // the version both ends speak
+    uint32_t maxInFlight; // requests the server reads before one of them is answered
+};
+
+struct muxRequest {
+
+    uint32_t id; // echoed back by the server
+    int32_t selection;
+};
+
+struct muxResponse {
+
+    uint32_t id;
+    int32_t length; // bytes of output following the header
+};
+
+constexpr char MUX_MAGIC[3] = { 'C', 'N', 'T' };
+constexpr uint8_t MUX_VERSION = 1;
+
+/**
+ * The MuxConnection class is a single connection to the server that every client thread sends its request on.
+ * Requests are tagged with an id and the server answers each as soon as its output is ready, a reader thread
+ * hands every answer to the thread waiting for that id. No more requests are sent than the server accepts
+ * in flight, the others wait for a slot. It is shared by every client thread.
+ */
+class MuxConnection
+{
+public:
+    /**
+     * The MuxConnection constructor connects to the server, negotiates the protocol version and starts the
+     * reader thread. It exits if the server doesn't speak the multiplexed protocol.
+     *
+     * @param server
+     */
+    MuxConnection(const serverInfo& server);
+
+    /**
+     * The MuxConnection destructor closes the connection and waits for the reader thread.
+     *
+     * @param void
+     */
+    ~MuxConnection();
+
+    MuxConnection(const MuxConnection&) = delete;
+    MuxConnection& operator=(const MuxConnection&) = delete;
+
+    /**
+     * Request sends a selection and waits for its answer, which is copied into the buffer. It returns the
+     * length of the answer, or -1 if the connection broke first.
+     *
+     * @param selection
+     * @param buffer
+     * @param size
+     * @param firstByte  -  Set to when the header of the answer arrived.
+     * @return int
+     */
+    int Request(int selection, char* buffer, size_t size, std::chrono::steady_clock::time_point& firstByte);
+
+    /**
+     * GetMaxInFlight returns how many requests the server accepts in flight on the connection.
+     *
+     * @param void
+     * @return uint32_t
+     */
+    uint32_t GetMaxInFlight();
+
+private:
+    /**
+     * The pendingRequest struct is a request waiting for its answer, it lives on the requesting thread's stack.
+     */
+    struct pendingRequest {
+
+        char* buffer;
+        size_t size;
+        int length = -1;
+        bool done = false;
+        std::chrono::steady_clock::time_point firstByte;
+        std::condition_variable answered;
+    };
+
+    /**
+     * ReadResponses runs on the reader thread and completes the pending requests in whatever order the
+     * answers arrive. When the connection closes every request still pending fails.
+     *
+     * @param void
+     * @return void
+     */
+    void ReadResponses();
+
+private:
+    int m_ServerID;
+    uint32_t m_MaxInFlight;
+
+    std::mutex m_Lock; // guards everything below
+    std::condition_variable m_SlotFree;
+    std::unordered_map<uint32_t, pendingRequest*> m_Pending;
+    uint32_t m_NextID = 0;
+    uint32_t m_InFlight = 0;
+    bool m_Broken = false;
+
+    std::mutex m_WriteLock; // keeps the requests of concurrent threads from interleaving
+    std::thread m_Reader;
+};
+
+#endif // MUXCONNECTION_HPP
@@ -0,0 +1,161 @@
+#include "replay.hpp"
+
+#include <stdio.h> // fopen(), fread()
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <queue>
+#include <iomanip>
+#include <algorithm>
+
+namespace
+{
+    // head start so launching the first threads doesn't already put the replay behind schedule
+    constexpr auto LEAD_TIME = std::chrono::milliseconds(100);
+
+    // requests in flight at once, a request due while every worker is busy starts late and counts as such
+    constexpr size_t MAX_WORKERS = 64;
+}
+
+void replayTrace(const serverInfo& server, const std::string& path, double speed)
+{
+    // Read the whole trace up front so file access doesn't disturb the timing
+    FILE* fp = fopen(path.c_str(), "rb");
+    if(!fp)
+    {
+        std::cerr << "ERROR #" << errno << ": Opening the trace " << path << " failed.\n";
+        return;
+    }
+
+    traceHeader header;
+    if(fread(&header, sizeof(header), 1, fp) != 1 || header.magic != TRACE_MAGIC || header.recordSize != sizeof(traceRecord))
+    {
+        std::cerr << "[ERROR]: " << path << " is not a trace written by this version of the server.\n";
+        fclose(fp);
+        return;
+    }
+
+    std::vector<traceRecord> records;
+    traceRecord record;
+    while(fread(&record, sizeof(record), 1, fp) == 1)
+        records.push_back(record);
+    fclose(fp);
+
+    if(records.empty())
+    {
+        std::cout << "The trace is empty.\n";
+        return;
+    }
+
+    // the server records a request when it completes, put them back in arrival order
+    std::stable_sort(records.begin(), records.end(),
+        [](const traceRecord& a, const traceRecord& b) { return a.arrivalNano < b.arrivalNano; });
+
+    // start the replay's clock at the first arrival
+    const int64_t firstArrival = records.front().arrivalNano;
+    auto start = std::chrono::steady_clock::now() + LEAD_TIME;
+    auto dueTime = [&](size_t i)
+    {
+        return start + std::chrono::nanoseconds(int64_t((records[i].arrivalNano - firstArrival) / speed));
+    };
+
+    // the dispatcher queues every request when it is due and a fixed set of workers sends them
+    std::mutex queueLock;
+    std::condition_variable queued;
+    std::queue<size_t> due;
+    bool dispatched = false;
+    std::vector<double> replayedTimes(records.size());
+    std::vector<std::chrono::nanoseconds> lateness(records.size());
+
+    sscout << "Replaying " << records.size() << " requests at " << speed << "x speed.\n";
+    std::vector<std::thread> workers;
+    for(size_t w = 0; w < std::min(MAX_WORKERS, records.size()); w++)
+    {
+        workers.emplace_back([&]()
+        {
+            while(true)
+            {
+                size_t i;
+                {
+                    std::unique_lock<std::mutex> lock(queueLock);
+                    queued.wait(lock, [&]() { return !due.empty() || dispatched; });
+                    if(due.empty())
+                        return;
+                    i = due.front();
+                    due.pop();
+                }
+
+                lateness[i] = std::chrono::steady_clock::now() - dueTime(i);
+                serverInfo request = server;
+                request.userSelection = records[i].selection;
+                request.quiet = true;
+                Client client(request);
+
+                // the server's clock runs from accepting the connection to writing the last byte, so the
+                // matching client time leaves out connecting
+                connectionPhases phases = client.GetPhases();
+                replayedTimes[i] = phases.firstByte + phases.transfer;
+            }
+        });
+    }
+
+    for(size_t i = 0; i < records.size(); i++)
+    {
+        std::this_thread::sleep_until(dueTime(i));
+        {
+            std::lock_guard<std::mutex> lock(queueLock);
+            due.push(i);
+        }
+        queued.notify_one();
+    }
+    {
+        std::lock_guard<std::mutex> lock(queueLock);
+        dispatched = true;
+    }
+    queued.notify_all();
+    for(auto& t : workers)
+        t.join();
+
+    std::chrono::nanoseconds maxLateness = *std::max_element(lateness.begin(), lateness.end());
+
+    // Gather recorded and replayed latencies by selection, index 0 holds every request
+    constexpr int numSelections = 7;
+    std::vector<double> recorded[numSelections], replayed[numSelections];
+    for(size_t i = 0; i < records.size(); i++)
+    {
+        double recordedMilli = (records[i].queueMicro + records[i].serviceMicro) * 0.001;
+        double replayedMilli = replayedTimes[i];
+        int selection = records[i].selection >= 1 && records[i].selection < numSelections ? records[i].selection : 0;
+
+        recorded[0].push_back(recordedMilli);
+        replayed[0].push_back(replayedMilli);
+        if(selection != 0)
+        {
+            recorded[selection].push_back(recordedMilli);
+            replayed[selection].push_back(replayedMilli);
+        }
+    }
+
+    // recorded is the queue + service time measured by the server, replayed is connected until the last byte
+    // on the client, so the delta also holds one round trip
+    sscout << "\n------------------------------------------------------------------------------\n"
+           << "Dispatch fell behind schedule by at most " << maxLateness.count() * 1e-6 << " ms\n"
+           << "Recorded: accepted until answered on the server. Replayed: connected until the last byte on the client.\n\n"
+           << std::left << std::setw(11) << "Selection" << std::setw(9) << "Count"
+           << std::setw(15) << "Recorded p50" << std::setw(15) << "Replayed p50"
+           << std::setw(15) << "Recorded p99" << std::setw(15) << "Replayed p99" << "Delta p99 (ms)\n";
+    for(int s = 0; s < numSelections; s++)
+    {
+        if(recorded[s].empty())
+            continue;
+
+        double recordedP99 = percentile(recorded[s], 99), replayedP99 = percentile(replayed[s], 99);
+        sscout << std::left << std::setw(11) << (s == 0 ? std::string("all") : std::to_string(s))
+               << std::setw(9) << recorded[s].size()
+               << std::setw(15) << percentile(recorded[s], 50) << std::setw(15) << percentile(replayed[s], 50)
+               << std::setw(15) << recordedP99 << std::setw(15) << replayedP99
+               << replayedP99 - recordedP99 << '\n';
+    }
+    sscout << std::endl;
+}
@@ -0,0 +1,43 @@
+#ifndef REPLAY_HPP
+#define REPLAY_HPP
+
+#include <stdint.h> // fixed width integers
+#include <string>
+
+#include "client.hpp"
+
+/**
+ * The traceHeader and traceRecord structs are the layout of the trace files written by the server's
+ * --trace option, see server/tracer.hpp. They have to be kept in sync with the server.
+ */
+struct traceHeader {
+
+    uint32_t magic;
+    uint32_t recordSize;
+};
+
+struct traceRecord {
+
+    int64_t arrivalNano; // relative to the start of the trace
+    uint32_t queueMicro;
+    uint32_t serviceMicro;
+    int32_t selection;
+    uint32_t reserved;
+};
+
+constexpr uint32_t TRACE_MAGIC = 0x54524331; // "TRC1"
+
+/**
+ * The replayTrace function re-issues every request of a trace against the server with the original spacing
+ * between arrivals divided by the speed factor, from a bounded set of worker threads. Once every request is
+ * answered it prints, per selection, the latency the server recorded next to the time from connected until the
+ * last byte of the replayed request, which leaves connecting out just like the server's measurement.
+ *
+ * @param server  -  Address and port of the server, the selection is taken from the trace.
+ * @param path    -  The trace file.
+ * @param speed   -  2 replays twice as fast as recorded, 0.5 at half speed.
+ * @return void
+ */
+void replayTrace(const serverInfo& server, const std::string& path, double speed);
+
+#endif // REPLAY_HPP
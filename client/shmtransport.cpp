@@ -0,0 +1,157 @@
+#include "shmtransport.hpp"
+
+#include <linux/futex.h> // FUTEX_WAIT, FUTEX_WAKE
+#include <sys/syscall.h> // SYS_futex
+#include <string.h> // memcpy()
+#include <errno.h> // errno code
+#include <stdlib.h> // exit()
+#include <algorithm>
+#include <iostream>
+#include <thread>
+
+namespace
+{
+    // spins before going to sleep, most cache hits are answered faster than a futex round trip
+    constexpr int SPIN_LIMIT = 2000;
+
+    void futexWait(std::atomic<uint32_t>& word, uint32_t expected)
+    {
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT, expected, nullptr, nullptr, 0);
+    }
+
+    void futexWake(std::atomic<uint32_t>& word, int count)
+    {
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE, count, nullptr, nullptr, 0);
+    }
+
+    bool isDone(uint32_t done, uint32_t position)
+    {
+        return int32_t(done - (position + 1)) >= 0;
+    }
+}
+
+ShmTransport::ShmTransport(const std::string& ringName)
+{
+    m_Ring = static_cast<RingSegment*>(Map(ringName, sizeof(RingSegment), true));
+    if(m_Ring->magic.load(std::memory_order_acquire) != RING_MAGIC || m_Ring->ringSize != RING_SIZE)
+    {
+        std::cerr << "ERROR: request ring " << ringName << " has an incompatible layout.\n";
+        exit(0);
+    }
+
+    std::string cacheName(m_Ring->cacheName, strnlen(m_Ring->cacheName, sizeof(m_Ring->cacheName)));
+    m_Cache = static_cast<const SharedSegment*>(Map(cacheName, sizeof(SharedSegment), false));
+    if(m_Cache->magic.load(std::memory_order_acquire) != SEGMENT_MAGIC || m_Cache->version != SEGMENT_VERSION
+       || m_Cache->slotSize != SHARED_SLOT_SIZE)
+    {
+        std::cerr << "ERROR: shared cache " << cacheName << " has an incompatible layout.\n";
+        exit(0);
+    }
+}
+
+ShmTransport::~ShmTransport()
+{
+    munmap(m_Ring, sizeof(RingSegment));
+    munmap(const_cast<SharedSegment*>(m_Cache), sizeof(SharedSegment));
+}
+
+uint32_t ShmTransport::Publish(int selection)
+{
+    uint32_t position;
+    while(true)
+    {
+        // claim the next free cell
+        position = m_Ring->tail.load(std::memory_order_relaxed);
+        ringCell* cell;
+        while(true)
+        {
+            cell = &m_Ring->cells[position % RING_SIZE];
+            int32_t diff = int32_t(cell->sequence.load(std::memory_order_acquire) - position);
+            if(diff == 0 && m_Ring->tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                break;
+
+            // the ring is full, give the server a moment to free the cell
+            if(diff < 0)
+                std::this_thread::yield();
+            position = m_Ring->tail.load(std::memory_order_relaxed);
+        }
+
+        // tell the server who holds the cell, so it can skip it if we die before publishing
+        cell->claim.store((uint64_t(position) << 32) | uint32_t(getpid()), std::memory_order_release);
+        cell->selection = selection;
+
+        // the server frees a cell left unpublished for too long, claim another one if it gave up on ours
+        uint32_t expected = position;
+        if(cell->sequence.compare_exchange_strong(expected, position + 1, std::memory_order_release,
+                                                  std::memory_order_relaxed))
+            break;
+    }
+
+    // the server only needs the system call if it is asleep
+    m_Ring->wakeSeq.fetch_add(1);
+    if(m_Ring->serverSleeping.load())
+        futexWake(m_Ring->wakeSeq, 1);
+
+    return position;
+}
+
+void ShmTransport::WaitDone(uint32_t position)
+{
+    ringCell& cell = m_Ring->cells[position % RING_SIZE];
+    for(int spin = 0; spin < SPIN_LIMIT; spin++)
+    {
+        if(isDone(cell.done.load(std::memory_order_acquire), position))
+            return;
+    }
+
+    while(true)
+    {
+        // announce the sleep before the last look, the server checks the flag after storing done
+        cell.waiting.store(1);
+        uint32_t done = cell.done.load();
+        if(isDone(done, position))
+            return;
+        futexWait(cell.done, done);
+    }
+}
+
+int ShmTransport::ReadResponse(int selection, char* buffer, size_t size)
+{
+    const CacheSlot& slot = m_Cache->slots[selection - 1];
+    while(true)
+    {
+        // seqlock read, retried if the server published meanwhile
+        uint32_t before = slot.sequence.load(std::memory_order_acquire);
+        if(before & 1)
+            continue;
+
+        uint32_t length = std::min<uint32_t>(slot.length.load(std::memory_order_relaxed), size - 1);
+        memcpy(buffer, slot.data, length);
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(slot.sequence.load(std::memory_order_relaxed) == before)
+        {
+            buffer[length] = '\0';
+            return length;
+        }
+    }
+}
+
+void* ShmTransport::Map(const std::string& name, size_t size, bool writable)
+{
+    int fd = shm_open(name.c_str(), writable ? O_RDWR : O_RDONLY, 0);
+    if(fd < 0)
+    {
+        std::cerr << "ERROR #" << errno << ": Opening " << name << " failed, is the server running with --shm-ring?\n";
+        exit(0);
+    }
+
+    void* addr = mmap(nullptr, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(addr == MAP_FAILED)
+    {
+        std::cerr << "ERROR #" << errno << ": Mapping " << name << " failed.\n";
+        exit(0);
+    }
+    return addr;
+}
@@ -0,0 +1,131 @@
+#ifndef SHMTRANSPORT_HPP
+#define SHMTRANSPORT_HPP
+
+#include <sys/mman.h> // shm_open(), mmap()
+#include <fcntl.h> // O_* constants
+#include <unistd.h> // close()
+#include <stdint.h> // fixed width integers
+#include <atomic>
+#include <string>
+
+/**
+ * The layouts below are the server's shared memory objects, see server/sharedcache.hpp and server/shmring.hpp.
+ * They have to be kept in sync with the server, the magic numbers reject a segment with another layout.
+ */
+constexpr size_t SHARED_SLOT_SIZE = 1024 * 32;
+constexpr int SHARED_NUM_SLOTS = 6;
+constexpr uint32_t SEGMENT_MAGIC = 0x434e5431; // "CNT1"
+constexpr uint32_t SEGMENT_VERSION = 2;
+
+struct CacheSlot {
+
+    std::atomic<uint32_t> sequence; // seqlock, odd while the server publishes
+    std::atomic<uint32_t> length;
+    std::atomic<int64_t> timeStamp;
+    std::atomic<int64_t> leaseExpiry;
+    std::atomic<int32_t> refresher;
+    char data[SHARED_SLOT_SIZE];
+};
+
+struct SharedSegment {
+
+    std::atomic<uint32_t> magic;
+    uint32_t version;
+    uint32_t slotSize;
+    alignas(64) CacheSlot slots[SHARED_NUM_SLOTS];
+};
+
+constexpr uint32_t RING_SIZE = 256;
+constexpr uint32_t RING_MAGIC = 0x52494e32; // "RIN2"
+
+struct alignas(64) ringCell {
+
+    std::atomic<uint32_t> sequence; // position when free to claim, position + 1 once published
+    std::atomic<uint32_t> done; // position + 1 once the response is in the shared cache
+    std::atomic<uint32_t> waiting;
+    int32_t selection;
+    std::atomic<uint64_t> claim; // position in the high half and our pid in the low half
+};
+
+struct RingSegment {
+
+    std::atomic<uint32_t> magic;
+    uint32_t ringSize;
+    char cacheName[64];
+    alignas(64) std::atomic<uint32_t> tail;
+    alignas(64) std::atomic<uint32_t> head;
+    std::atomic<uint32_t> wakeSeq;
+    std::atomic<uint32_t> serverSleeping;
+    ringCell cells[RING_SIZE];
+};
+
+/**
+ * The ShmTransport class is the client's end of the server's shared memory ring. A request is published into
+ * the ring, the client sleeps on a futex until the server has made the selection's shared cache slot fresh
+ * and then copies the response straight out of the shared cache. It is shared by every client thread.
+ */
+class ShmTransport
+{
+public:
+    /**
+     * The ShmTransport constructor maps the ring and the shared cache it names. It exits if the server
+     * isn't serving the ring.
+     *
+     * @param ringName
+     */
+    ShmTransport(const std::string& ringName);
+
+    /**
+     * The ShmTransport destructor unmaps both segments.
+     *
+     * @param void
+     */
+    ~ShmTransport();
+
+    ShmTransport(const ShmTransport&) = delete;
+    ShmTransport& operator=(const ShmTransport&) = delete;
+
+    /**
+     * Publish puts a selection into the ring and wakes the server if it is asleep. It returns the position
+     * of the request, which is handed to WaitDone.
+     *
+     * @param selection
+     * @return uint32_t
+     */
+    uint32_t Publish(int selection);
+
+    /**
+     * WaitDone waits until the server has completed the request at the given position.
+     *
+     * @param position
+     * @return void
+     */
+    void WaitDone(uint32_t position);
+
+    /**
+     * ReadResponse copies the cached output of a selection into the buffer and returns its length.
+     *
+     * @param selection
+     * @param buffer
+     * @param size
+     * @return int
+     */
+    int ReadResponse(int selection, char* buffer, size_t size);
+
+private:
+    /**
+     * Map opens and maps a shared memory object, exiting if it doesn't exist.
+     *
+     * @param name
+     * @param size
+     * @param writable
+     * @return void*
+     */
+    static void* Map(const std::string& name, size_t size, bool writable);
+
+private:
+    RingSegment* m_Ring;
+    const SharedSegment* m_Cache;
+};
+
+#endif // SHMTRANSPORT_HPP
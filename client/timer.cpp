@@ -1,5 +1,8 @@
 #include "timer.hpp"
 
+#include <algorithm>
+#include <cmath>
+
 void Timer::StartTimer(){
     // record start time
     m_StartTime = std::chrono::high_resolution_clock::now();
@@ -20,4 +23,15 @@ void Timer::StopTimer(){
 }
 
 std::chrono::milliseconds Timer::GetDurationMilli(){ return m_DurationMilli; }
-std::chrono::microseconds Timer::GetDurationMicro(){ return m_DurationMicro; }
\ No newline at end of file
+std::chrono::microseconds Timer::GetDurationMicro(){ return m_DurationMicro; }
+
+double percentile(std::vector<double> data, double p)
+{
+    if(data.empty())
+        return 0;
+
+    std::sort(data.begin(), data.end());
+    size_t rank = size_t(std::ceil(p / 100.0 * data.size()));
+    rank = std::min(std::max<size_t>(rank, 1), data.size());
+    return data[rank - 1];
+}
\ No newline at end of file
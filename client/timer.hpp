@@ -2,6 +2,7 @@
 #define TIMER_HPP
 
 #include <chrono>
+#include <vector>
 
 /**
  * The Timer class is a simple header only class used to measure the performance and turn-around time
@@ -61,4 +62,14 @@ private:
     std::chrono::milliseconds m_DurationMilli;
 };
 
+/**
+ * The percentile function accepts a list of turn-around times and a percentile between 0 and 100
+ * and returns the turn-around time at that percentile using the nearest rank.
+ * 
+ * @param std::vector<double>
+ * @param double
+ * @return double
+ */
+double percentile(std::vector<double> data, double p);
+
 #endif
\ No newline at end of file
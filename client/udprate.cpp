@@ -0,0 +1,158 @@
+#include "udprate.hpp"
+
+#include <sys/time.h> // timeval
+#include <vector>
+#include <future>
+#include <algorithm> // std::max
+
+namespace
+{
+    // requests in flight per thread, sent and collected with one system call each
+    constexpr int WINDOW = 64;
+
+    // a window still missing answers after this long counts them as lost
+    constexpr int RECV_TIMEOUT_MICRO = 100000;
+
+    // every request is padded so the server may answer with any output that fits a datagram
+    const char REQUEST_PADDING[UDP_MAX_PAYLOAD] = {};
+
+    struct udpResult {
+
+        uint64_t answered = 0;
+        uint64_t redirected = 0;
+        uint64_t lost = 0;
+        std::vector<double> roundTrips; // ms
+        std::chrono::steady_clock::time_point floodEnd; // the redirects are fetched after this
+    };
+
+    udpResult floodServer(const serverInfo& server, std::chrono::steady_clock::time_point deadline)
+    {
+        udpResult result;
+        const resolvedAddress& address = server.addresses.front();
+
+        // connected so the kernel only hands us datagrams from the server
+        int udpID = socket(address.family, SOCK_DGRAM, 0);
+        CHK_ERR(udpID, "Creating a datagram socket")
+        CHK_ERR(connect(udpID, (const sockaddr*)&address.address, address.length), "Connecting the datagram socket")
+
+        timeval timeout = { 0, RECV_TIMEOUT_MICRO };
+        CHK_ERR(setsockopt(udpID, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)), "Setting the receive timeout")
+
+        std::vector<udpRequest> requests(WINDOW);
+        std::vector<std::array<iovec, 2>> requestVecs(WINDOW);
+        std::vector<mmsghdr> sent(WINDOW);
+
+        struct answer {
+
+            udpResponse header;
+            char data[UDP_MAX_PAYLOAD];
+        };
+        std::vector<answer> answers(WINDOW);
+        std::vector<iovec> answerVecs(WINDOW);
+        std::vector<mmsghdr> received(WINDOW);
+
+        for(int i = 0; i < WINDOW; i++)
+        {
+            memset(&sent[i], 0, sizeof(mmsghdr));
+            requestVecs[i][0] = { &requests[i], sizeof(udpRequest) };
+            requestVecs[i][1] = { const_cast<char*>(REQUEST_PADDING), sizeof(REQUEST_PADDING) };
+            sent[i].msg_hdr.msg_iov = requestVecs[i].data();
+            sent[i].msg_hdr.msg_iovlen = 2;
+
+            memset(&received[i], 0, sizeof(mmsghdr));
+            answerVecs[i] = { &answers[i], sizeof(answer) };
+            received[i].msg_hdr.msg_iov = &answerVecs[i];
+            received[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        uint32_t firstTag = 0;
+        while(std::chrono::steady_clock::now() < deadline)
+        {
+            for(int i = 0; i < WINDOW; i++)
+                requests[i] = { server.userSelection, firstTag + i };
+
+            auto sendTime = std::chrono::steady_clock::now();
+            int numSent = sendmmsg(udpID, sent.data(), WINDOW, 0);
+            CHK_ERR(numSent, "Sending datagrams")
+
+            int numReceived = 0;
+            while(numReceived < numSent)
+            {
+                int count = recvmmsg(udpID, received.data(), numSent - numReceived, MSG_WAITFORONE, nullptr);
+                if(count < 0)
+                {
+                    if(errno == EINTR)
+                        continue;
+                    break; // timed out, the rest of the window was dropped somewhere
+                }
+
+                auto now = std::chrono::steady_clock::now();
+                for(int i = 0; i < count; i++)
+                {
+                    // answers to an earlier window that timed out are late, not new
+                    const udpResponse& header = answers[i].header;
+                    if(received[i].msg_len < sizeof(udpResponse) || header.tag - firstTag >= uint32_t(WINDOW))
+                        continue;
+
+                    numReceived++;
+                    result.answered++;
+                    result.roundTrips.push_back(std::chrono::duration<double, std::milli>(now - sendTime).count());
+                    if(header.length == UDP_REDIRECT)
+                        result.redirected++;
+                }
+            }
+
+            result.lost += numSent - numReceived;
+            firstTag += WINDOW;
+        }
+        result.floodEnd = std::chrono::steady_clock::now();
+        close(udpID);
+        return result;
+    }
+}
+
+void measureUdpRate(const serverInfo& server, int numClients, double seconds)
+{
+    if(server.addresses.front().family == AF_UNIX)
+    {
+        std::cerr << "[ERROR]: the datagram mode needs the server's IP address and port.\n";
+        return;
+    }
+
+    sscout << "Flooding the datagram port from " << numClients << " threads for " << seconds << " seconds.\n";
+    auto start = std::chrono::steady_clock::now();
+    auto deadline = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(seconds));
+
+    std::vector<std::future<udpResult>> futures;
+    for(int i = 0; i < numClients; i++)
+        futures.emplace_back(std::async(std::launch::async, floodServer, std::cref(server), deadline));
+
+    udpResult total;
+    total.floodEnd = start;
+    for(auto& future : futures)
+    {
+        udpResult result = future.get();
+        total.answered += result.answered;
+        total.redirected += result.redirected;
+        total.lost += result.lost;
+        total.roundTrips.insert(total.roundTrips.end(), result.roundTrips.begin(), result.roundTrips.end());
+        total.floodEnd = std::max(total.floodEnd, result.floodEnd);
+    }
+    double elapsed = std::chrono::duration<double>(total.floodEnd - start).count();
+
+    // every redirect was for the same selection, fetching it once over TCP shows the fallback works
+    // without adding more TCP work than the datagrams being measured
+    if(total.redirected > 0)
+    {
+        serverInfo tcp = server;
+        tcp.quiet = true;
+        Client client(tcp);
+    }
+
+    sscout << "\n------------------------------------------------------------------------------\n"
+           << "Answered requests: " << total.answered << " (" << total.redirected << " redirected to TCP, fetched once after the flood)\n"
+           << "Lost datagrams: " << total.lost << '\n'
+           << "Request rate: " << total.answered / elapsed << " requests/s\n"
+           << "The p50 / p99 round trip time: " << percentile(total.roundTrips, 50) << " / "
+           << percentile(total.roundTrips, 99) << " ms\n" << std::endl;
+}
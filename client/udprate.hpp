@@ -0,0 +1,42 @@
+#ifndef UDPRATE_HPP
+#define UDPRATE_HPP
+
+#include <stdint.h> // fixed width integers
+#include <stddef.h> // size_t
+
+#include "client.hpp"
+
+/**
+ * The udpRequest and udpResponse structs are the server's datagram protocol, see server/server.hpp.
+ * They have to be kept in sync with the server.
+ */
+struct udpRequest {
+
+    int32_t selection;
+    uint32_t tag; // echoed back by the server
+}; // followed by the zero padding that pays for the answer
+
+struct udpResponse {
+
+    uint32_t tag;
+    int32_t length; // bytes of output following the header, or UDP_REDIRECT
+};
+
+constexpr int32_t UDP_REDIRECT = -1; // the output doesn't fit a datagram, ask over TCP
+constexpr size_t UDP_MAX_PAYLOAD = 1400;
+
+/**
+ * The measureUdpRate function floods the server's datagram port from numClients threads for the given number of
+ * seconds. Each thread sends a window of requests with one sendmmsg and collects the answers with recvmmsg, every
+ * request is padded with UDP_MAX_PAYLOAD zeros so the server may answer it with any output that fits a datagram,
+ * a redirected selection is fetched once over TCP after the flood and doesn't count towards the rate. It prints the
+ * request rate, the round trip percentiles and how many datagrams were lost or redirected.
+ *
+ * @param server      -  Address, port and selection, the first resolved address is used.
+ * @param numClients
+ * @param seconds
+ * @return void
+ */
+void measureUdpRate(const serverInfo& server, int numClients, double seconds);
+
+#endif // UDPRATE_HPP
@@ -1,5 +1,7 @@
 #include <iostream>
 #include <limits>
+#include <string>
+#include <algorithm>
 
 #include "server.hpp"
 
@@ -11,13 +13,36 @@
  */
 int getPortNumber();
 
-int main()
+/**
+ * getServerOptions is a function that reads the optional server features from the command line arguments.
+ * The function accepts the arguments given to main and returns a serverOptions struct.
+ * 
+ *   --shared-cache [name]   share the command cache with other server processes on this host
+ *   --reuse-port            allow several server processes to listen on the same port
+ *   --snapshot <file>       save the cache to file at shut down and load it at start up, ignored with a shared cache
+ *   --pin-cpus              pin every worker thread to its own core
+ *   --numa                  one job queue and cache per NUMA node, workers stay on their node
+ *   --coroutines <loops>    serve connections from coroutines on this many event loops
+ *   --trace <file>          record arrival, selection, queue and service time of every request
+ *   --unix <path>           also listen on a Unix domain socket at path
+ *   --shm-ring [name]       serve same host clients through a shared memory ring, turns on --shared-cache
+ *   --udp [threads]         also answer datagrams on the port, on this many threads (default 1)
+ *   --spawn-helpers <n>     run the commands in n helper processes forked at start up, 0 to popen from the workers
+ * 
+ * @param argc
+ * @param argv
+ * @return serverOptions
+ */
+serverOptions getServerOptions(int argc, char** argv);
+
+int main(int argc, char** argv)
 {
-    // Get the port number from the user
+    // Get the optional features and port number from the user
+    serverOptions options = getServerOptions(argc, argv);
     int portNumber = getPortNumber();
 
     // Create a server socket and listen for connections
-    Server server(portNumber);
+    Server server(portNumber, options);
     server.AcceptCons();
 
     // Clean up
@@ -45,4 +70,80 @@ int getPortNumber()
     }
 
     return portNum;
+}
+
+serverOptions getServerOptions(int argc, char** argv)
+{
+    serverOptions options;
+
+    for(int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if(arg == "--shared-cache")
+        {
+            options.sharedCache = true;
+            if(i + 1 < argc && argv[i + 1][0] == '/')
+                options.sharedCacheName = argv[++i];
+        }
+        else if(arg == "--reuse-port")
+        {
+            options.reusePort = true;
+        }
+        else if(arg == "--snapshot" && i + 1 < argc)
+        {
+            options.snapshotPath = argv[++i];
+        }
+        else if(arg == "--pin-cpus")
+        {
+            options.pinCpus = true;
+        }
+        else if(arg == "--numa")
+        {
+            options.numa = true;
+        }
+        else if(arg == "--coroutines" && i + 1 < argc)
+        {
+            options.eventLoops = std::max(1, atoi(argv[++i]));
+        }
+        else if(arg == "--trace" && i + 1 < argc)
+        {
+            options.tracePath = argv[++i];
+        }
+        else if(arg == "--unix" && i + 1 < argc)
+        {
+            options.unixPath = argv[++i];
+        }
+        else if(arg == "--shm-ring")
+        {
+            // the ring's responses are read from the shared cache
+            options.sharedCache = true;
+            options.ringName = "/cnt4504_ring";
+            if(i + 1 < argc && argv[i + 1][0] == '/')
+                options.ringName = argv[++i];
+        }
+        else if(arg == "--udp")
+        {
+            options.udpThreads = 1;
+            if(i + 1 < argc && isdigit(argv[i + 1][0]))
+                options.udpThreads = std::max(1, atoi(argv[++i]));
+        }
+        else if(arg == "--spawn-helpers" && i + 1 < argc)
+            options.spawnHelpers = std::max(0, atoi(argv[++i]));
+        else
+        {
+            std::cerr << "[ERROR]: Unknown option " << arg << '\n'
+                      << "Usage: " << argv[0] << " [--shared-cache [name]] [--reuse-port] [--snapshot <file>] [--pin-cpus] [--numa] [--coroutines <loops>] [--trace <file>] [--unix <path>] [--shm-ring [name]] [--udp [threads]] [--spawn-helpers <n>]\n";
+            exit(0);
+        }
+    }
+
+    // the shared segment already outlives the server processes, there is no process local cache to save
+    if(options.sharedCache && !options.snapshotPath.empty())
+    {
+        std::cerr << "[WARNING]: --snapshot is ignored with --shared-cache and --shm-ring, "
+                  << "the shared cache keeps its outputs across restarts on its own.\n";
+        options.snapshotPath.clear();
+    }
+
+    return options;
 }
\ No newline at end of file
@@ -0,0 +1,37 @@
+#!/bin/bash
+# Compares cross-core cache traffic of the server with and without worker placement.
+# Every run floods a fresh server with the client and reports the perf counters of the server process.
+#
+# usage: ./bench_affinity.sh [port] [selection] [rounds]
+# needs perf and both the server and client built with make
+
+PORT=${1:-4100}
+SELECTION=${2:-1}
+ROUNDS=${3:-20}
+EVENTS=cache-references,cache-misses,LLC-load-misses,cpu-migrations,context-switches
+
+cd "$(dirname "$0")"
+if ! command -v perf > /dev/null; then
+    echo "perf is not installed"
+    exit 1
+fi
+
+for FLAGS in "" "--pin-cpus" "--numa" "--numa --pin-cpus"; do
+    echo "=== server ${FLAGS:-(no placement)} ==="
+
+    echo "$PORT" | perf stat -e "$EVENTS" -o perf_output.txt ./server $FLAGS > /dev/null &
+    PERF=$!
+    sleep 1
+    SERVER=$(pgrep -P "$PERF" -x server)
+
+    for ((i = 0; i < ROUNDS; i++)); do
+        printf "localhost\n%s\n%s\n100\n" "$PORT" "$SELECTION" | ../client/client > /dev/null
+    done
+
+    # SIGINT lets the server shut down cleanly so perf prints its counters
+    kill -INT "$SERVER"
+    wait "$PERF"
+    grep -E "cache|migrations|switches" perf_output.txt
+    rm -f perf_output.txt
+    PORT=$((PORT + 1))
+done
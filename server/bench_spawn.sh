@@ -0,0 +1,49 @@
+#!/bin/bash
+# Compares the latency jitter of cheap requests while the expensive commands keep missing the cache, once with
+# the workers running the commands through popen and once through the pre-forked spawn helpers.
+# Loader clients keep asking for ps and netstat so a command runs every time their cache expires, while the
+# measured clients ask for a cached selection on kept alive connections.
+#
+# usage: ./bench_spawn.sh [port] [selection] [clients] [rounds]
+# needs both the server and client built with make
+
+PORT=${1:-4300}
+SELECTION=${2:-1}
+CLIENTS=${3:-25}
+ROUNDS=${4:-200}
+
+cd "$(dirname "$0")"
+
+load() {
+    while true; do
+        printf "localhost\n%s\n%s\n5\n" "$PORT" "$1" | ../client/client --keep-alive --rounds 20 > /dev/null
+    done
+}
+
+run() {
+    echo "=== $1 ==="
+    shift
+    echo "$PORT" | ./server "$@" > /dev/null &
+    SERVER=$!
+    sleep 1
+
+    # each loader runs in its own process group, so it and the client it is running stop together
+    set -m
+    load 4 & LOAD_NETSTAT=$!
+    load 6 & LOAD_PS=$!
+    set +m
+    sleep 1
+
+    printf "localhost\n%s\n%s\n%s\n" "$PORT" "$SELECTION" "$CLIENTS" \
+        | ../client/client --keep-alive --rounds "$ROUNDS" | grep -E "p50 / p99 turn-around|Throughput"
+
+    kill -- -$LOAD_NETSTAT -$LOAD_PS
+    wait $LOAD_NETSTAT $LOAD_PS 2> /dev/null
+    kill -INT "$SERVER"
+    wait "$SERVER"
+}
+
+run "popen from the workers" --spawn-helpers 0
+run "spawn helpers"
+
+rm -f data_output.txt ../client/data_output.txt
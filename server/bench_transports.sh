@@ -0,0 +1,39 @@
+#!/bin/bash
+# Compares the latency and throughput of TCP loopback, the Unix domain socket and the shared memory ring.
+# One server serves all three transports, each transport is flooded by the client with the same burst.
+#
+# usage: ./bench_transports.sh [port] [selection] [clients] [rounds]
+# needs both the server and client built with make
+
+PORT=${1:-4200}
+SELECTION=${2:-1}
+CLIENTS=${3:-100}
+ROUNDS=${4:-20}
+SOCKET=/tmp/cnt4504_bench.sock
+
+cd "$(dirname "$0")"
+
+echo "$PORT" | ./server --unix "$SOCKET" --shm-ring > /dev/null &
+SERVER=$!
+sleep 1
+
+run() {
+    echo "=== $1 ==="
+    shift
+    printf "%s" "$INPUT" | ../client/client --rounds "$ROUNDS" "$@" | grep -E "p50 / p99 turn-around|Throughput"
+}
+
+INPUT=$(printf "localhost\n%s\n%s\n%s\n" "$PORT" "$SELECTION" "$CLIENTS")
+run "tcp loopback"
+run "tcp loopback, keep-alive" --keep-alive
+
+INPUT=$(printf "%s\n%s\n%s\n" "$SOCKET" "$SELECTION" "$CLIENTS")
+run "unix domain socket"
+run "unix domain socket, keep-alive" --keep-alive
+
+INPUT=$(printf "%s\n%s\n" "$SELECTION" "$CLIENTS")
+run "shared memory ring" --shm
+
+kill -INT "$SERVER"
+wait "$SERVER"
+rm -f data_output.txt ../client/data_output.txt
@@ -0,0 +1,273 @@
+#include "eventloop.hpp"
+#include "server.hpp" // CHK_ERR
+
+namespace
+{
+    // the loop running on this thread, set by Run
+    thread_local EventLoop* currentLoop = nullptr;
+
+    constexpr int MAX_EVENTS = 64;
+}
+
+EventLoop::EventLoop()
+{
+    m_EpollID = epoll_create1(EPOLL_CLOEXEC);
+    CHK_ERR(m_EpollID, "Creating the event loop")
+
+    m_WakeID = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    CHK_ERR(m_WakeID, "Creating the event loop wake up fd")
+
+    // the wake up fd is the only registration without a waiter
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.ptr = nullptr;
+    CHK_ERR(epoll_ctl(m_EpollID, EPOLL_CTL_ADD, m_WakeID, &event), "Registering the wake up fd")
+}
+
+EventLoop::~EventLoop()
+{
+    close(m_WakeID);
+    close(m_EpollID);
+}
+
+EventLoop* EventLoop::Current() { return currentLoop; }
+
+void EventLoop::Run()
+{
+    currentLoop = this;
+    m_Running = true;
+
+    epoll_event events[MAX_EVENTS];
+    while(m_Running)
+    {
+        RunPosted();
+        int timeout = RunTimers();
+
+        int numEvents = epoll_wait(m_EpollID, events, MAX_EVENTS, timeout);
+        if(numEvents < 0 && errno == EINTR)
+            continue;
+        CHK_ERR(numEvents, "Waiting for events")
+
+        for(int i = 0; i < numEvents; i++)
+        {
+            ioWaiter* waiter = static_cast<ioWaiter*>(events[i].data.ptr);
+            if(!waiter)
+            {
+                // Post or Stop woke us up, drain the counter
+                uint64_t count;
+                while(read(m_WakeID, &count, sizeof(count)) > 0)
+                    ;
+                continue;
+            }
+
+            if(!waiter->handle)
+            {
+                // nobody is accepting right now, drop the level triggered registration until someone is
+                epoll_ctl(m_EpollID, EPOLL_CTL_DEL, waiter->listenID, nullptr);
+                m_Registered.erase(std::find(m_Registered.begin(), m_Registered.end(), waiter->listenID));
+                continue;
+            }
+
+            std::exchange(waiter->handle, nullptr).resume();
+        }
+    }
+
+    currentLoop = nullptr;
+}
+
+void EventLoop::Stop()
+{
+    m_Running = false;
+    uint64_t one = 1;
+    write(m_WakeID, &one, sizeof(one));
+}
+
+void EventLoop::Drain()
+{
+    currentLoop = this;
+    while(true)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_PostLock);
+            if(m_Posted.empty())
+                break;
+        }
+        RunPosted();
+    }
+    currentLoop = nullptr;
+}
+
+void EventLoop::Spawn(Task<> task)
+{
+    task.Detach().resume();
+}
+
+void EventLoop::Post(std::coroutine_handle<> handle)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_PostLock);
+        m_Posted.push_back(handle);
+    }
+    uint64_t one = 1;
+    write(m_WakeID, &one, sizeof(one));
+}
+
+void EventLoop::RunPosted()
+{
+    std::vector<std::coroutine_handle<>> posted;
+    {
+        std::lock_guard<std::mutex> lock(m_PostLock);
+        posted.swap(m_Posted);
+    }
+
+    for(auto handle : posted)
+        handle.resume();
+}
+
+int EventLoop::RunTimers()
+{
+    while(!m_Timers.empty())
+    {
+        auto now = std::chrono::steady_clock::now();
+        timer next = m_Timers.top();
+        if(next.deadline > now)
+        {
+            // round up so we never wake up just before the deadline
+            auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(next.deadline - now);
+            return int(wait.count()) + 1;
+        }
+
+        m_Timers.pop();
+        next.handle.resume();
+    }
+    return -1;
+}
+
+void EventLoop::Wait(int fd, uint32_t events, ioWaiter* waiter)
+{
+    epoll_event event = {};
+    event.events = events | EPOLLONESHOT;
+    event.data.ptr = waiter;
+
+    // the fd stays registered after a one shot event fired, so re-arm it and only add it the first time
+    if(epoll_ctl(m_EpollID, EPOLL_CTL_MOD, fd, &event) < 0)
+    {
+        CHK_ERR(epoll_ctl(m_EpollID, EPOLL_CTL_ADD, fd, &event), "Registering an fd with the event loop")
+    }
+}
+
+void EventLoop::fdAwaiter::await_suspend(std::coroutine_handle<> handle)
+{
+    waiter.handle = handle;
+    loop.Wait(fd, events, &waiter);
+}
+
+EventLoop::ioWaiter& EventLoop::AcceptWaiter(int listenID)
+{
+    for(auto& waiter : m_AcceptWaiters)
+    {
+        if(waiter->listenID == listenID)
+            return *waiter;
+    }
+
+    // owned by the loop rather than the awaiter, epoll keeps pointing at it between accepts
+    m_AcceptWaiters.push_back(std::make_unique<ioWaiter>());
+    m_AcceptWaiters.back()->listenID = listenID;
+    return *m_AcceptWaiters.back();
+}
+
+void EventLoop::acceptAwaiter::await_suspend(std::coroutine_handle<> handle)
+{
+    ioWaiter& waiter = loop.AcceptWaiter(listenID);
+    waiter.handle = handle;
+    if(std::find(loop.m_Registered.begin(), loop.m_Registered.end(), listenID) != loop.m_Registered.end())
+        return;
+
+    epoll_event event = {};
+    event.events = EPOLLIN | EPOLLEXCLUSIVE;
+    event.data.ptr = &waiter;
+    CHK_ERR(epoll_ctl(loop.m_EpollID, EPOLL_CTL_ADD, listenID, &event), "Registering the listening socket")
+    loop.m_Registered.push_back(listenID);
+}
+
+void EventLoop::sleepAwaiter::await_suspend(std::coroutine_handle<> handle)
+{
+    loop.m_Timers.push({ deadline, handle });
+}
+
+Task<int> EventLoop::AsyncAccept(int listenID)
+{
+    while(true)
+    {
+        int clientID = accept4(listenID, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(clientID >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+            co_return clientID;
+
+        if(errno == EAGAIN || errno == EWOULDBLOCK)
+            co_await acceptAwaiter{ *this, listenID };
+    }
+}
+
+Task<ssize_t> EventLoop::AsyncReadExact(int fd, void* buffer, size_t size)
+{
+    size_t total = 0;
+    while(total < size)
+    {
+        ssize_t numBytes = read(fd, static_cast<char*>(buffer) + total, size - total);
+        if(numBytes > 0)
+            total += numBytes;
+        else if(numBytes == 0)
+            co_return 0; // closed before everything arrived
+        else if(errno == EAGAIN || errno == EWOULDBLOCK)
+            co_await fdAwaiter{ *this, fd, EPOLLIN, {} };
+        else if(errno != EINTR)
+            co_return -1;
+    }
+    co_return ssize_t(total);
+}
+
+Task<ssize_t> EventLoop::AsyncWriteAll(int fd, const void* buffer, size_t size)
+{
+    size_t total = 0;
+    while(total < size)
+    {
+        ssize_t numBytes = send(fd, static_cast<const char*>(buffer) + total, size - total, MSG_NOSIGNAL);
+        if(numBytes >= 0)
+            total += numBytes;
+        else if(errno == EAGAIN || errno == EWOULDBLOCK)
+            co_await fdAwaiter{ *this, fd, EPOLLOUT, {} };
+        else if(errno != EINTR)
+            co_return -1;
+    }
+    co_return ssize_t(total);
+}
+
+EventLoop::sleepAwaiter EventLoop::SleepFor(std::chrono::milliseconds duration)
+{
+    return { *this, std::chrono::steady_clock::now() + duration };
+}
+
+void EventLoop::WatchIdle(int fd)
+{
+    m_IdleSince[fd] = std::chrono::steady_clock::now();
+}
+
+void EventLoop::UnwatchIdle(int fd)
+{
+    m_IdleSince.erase(fd);
+}
+
+void EventLoop::ExpireIdle(std::chrono::steady_clock::time_point cutoff)
+{
+    for(auto it = m_IdleSince.begin(); it != m_IdleSince.end(); )
+    {
+        if(it->second >= cutoff)
+        {
+            ++it;
+            continue;
+        }
+
+        shutdown(it->first, SHUT_RDWR);
+        it = m_IdleSince.erase(it);
+    }
+}
@@ -0,0 +1,279 @@
+#ifndef EVENTLOOP_HPP
+#define EVENTLOOP_HPP
+
+#include <sys/epoll.h> // epoll_create1(), epoll_wait()
+#include <sys/eventfd.h> // eventfd() wake ups
+#include <sys/socket.h> // accept4()
+#include <unistd.h> // read(), write()
+#include <errno.h> // errno error code
+#include <coroutine>
+#include <chrono>
+#include <mutex>
+#include <queue>
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include <unordered_map> // idle connections
+
+#include "task.hpp"
+
+/**
+ * The EventLoop class is a single threaded scheduler for the server's coroutines. Each loop owns an epoll
+ * instance, a timer heap and a queue of coroutines posted from other threads. The awaitables it hands out
+ * try the system call first and only suspend the coroutine when the call would block, the loop resumes it
+ * once epoll reports the fd as ready again.
+ */
+class EventLoop
+{
+public:
+    /**
+     * The EventLoop constructor creates the epoll instance and the eventfd used to wake it up.
+     *
+     * @param void
+     */
+    EventLoop();
+
+    /**
+     * The EventLoop destructor closes the epoll instance and the eventfd.
+     *
+     * @param void
+     */
+    ~EventLoop();
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    /**
+     * The Run method resumes ready coroutines until Stop is called. It makes this loop the current loop
+     * of the calling thread.
+     *
+     * @param void
+     * @return void
+     */
+    void Run();
+
+    /**
+     * The Stop method asks the loop to return from Run. It can be called from any thread.
+     *
+     * @param void
+     * @return void
+     */
+    void Stop();
+
+    /**
+     * The Drain method resumes the coroutines posted to a loop that has stopped running, until none are left.
+     * It is called at shut down once nothing can post anymore, so the coroutines the thread pool finished
+     * for get to write their answer and release their connection.
+     *
+     * @param void
+     * @return void
+     */
+    void Drain();
+
+    /**
+     * The Spawn method starts a task on this loop without waiting for it. The task frees itself once done.
+     * It must be called from the loop's thread.
+     *
+     * @param task
+     * @return void
+     */
+    void Spawn(Task<> task);
+
+    /**
+     * The Post method queues a coroutine to be resumed on this loop. It can be called from any thread and is
+     * how work finished on the thread pool hands back to the connection's loop.
+     *
+     * @param handle
+     * @return void
+     */
+    void Post(std::coroutine_handle<> handle);
+
+    /**
+     * Current returns the loop running on the calling thread, or nullptr.
+     *
+     * @param void
+     * @return EventLoop*
+     */
+    static EventLoop* Current();
+
+    /**
+     * The ioWaiter struct is what an epoll event points at: the coroutine waiting for the fd.
+     */
+    struct ioWaiter {
+
+        std::coroutine_handle<> handle;
+        int listenID = -1; // set for a listening socket, which stays registered between accepts
+    };
+
+    /**
+     * The fdAwaiter struct suspends a coroutine until an fd is ready for the given epoll events.
+     * The fd is registered one shot so the loop never holds on to the waiter after resuming it.
+     */
+    struct fdAwaiter {
+
+        EventLoop& loop;
+        int fd;
+        uint32_t events;
+        ioWaiter waiter;
+
+        bool await_ready() noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> handle);
+        void await_resume() noexcept {}
+    };
+
+    /**
+     * The acceptAwaiter struct suspends the accepting coroutine until the listening socket has a connection.
+     * The listening socket stays registered with EPOLLEXCLUSIVE so several loops can share it without
+     * all of them waking up for every connection. A loop can accept on several listening sockets at once.
+     */
+    struct acceptAwaiter {
+
+        EventLoop& loop;
+        int listenID;
+
+        bool await_ready() noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> handle);
+        void await_resume() noexcept {}
+    };
+
+    /**
+     * The sleepAwaiter struct suspends a coroutine until the deadline passes.
+     */
+    struct sleepAwaiter {
+
+        EventLoop& loop;
+        std::chrono::steady_clock::time_point deadline;
+
+        bool await_ready() noexcept { return std::chrono::steady_clock::now() >= deadline; }
+        void await_suspend(std::coroutine_handle<> handle);
+        void await_resume() noexcept {}
+    };
+
+    /**
+     * AsyncAccept accepts a connection on a non-blocking listening socket. It returns the new non-blocking
+     * fd, or -1 with errno set if accept failed for a reason other than having nothing to accept.
+     *
+     * @param  listenID
+     * @return Task<int>
+     */
+    Task<int> AsyncAccept(int listenID);
+
+    /**
+     * AsyncReadExact reads exactly size bytes from a non-blocking fd. It returns size, 0 if the peer closed
+     * the connection first, or -1 with errno set on an error.
+     *
+     * @param  fd
+     * @param  buffer
+     * @param  size
+     * @return Task<ssize_t>
+     */
+    Task<ssize_t> AsyncReadExact(int fd, void* buffer, size_t size);
+
+    /**
+     * AsyncWriteAll writes all size bytes to a non-blocking fd. It returns size, or -1 with errno set on an error.
+     *
+     * @param  fd
+     * @param  buffer
+     * @param  size
+     * @return Task<ssize_t>
+     */
+    Task<ssize_t> AsyncWriteAll(int fd, const void* buffer, size_t size);
+
+    /**
+     * SleepFor suspends the calling coroutine for the given duration without blocking the loop.
+     *
+     * @param  duration
+     * @return sleepAwaiter
+     */
+    sleepAwaiter SleepFor(std::chrono::milliseconds duration);
+
+    /**
+     * WatchIdle marks a connection as idle from now on, until UnwatchIdle is called once its next request
+     * arrived. Both must be called from the loop's thread.
+     *
+     * @param  fd
+     * @return void
+     */
+    void WatchIdle(int fd);
+
+    /**
+     * UnwatchIdle stops watching a connection that is no longer idle.
+     *
+     * @param  fd
+     * @return void
+     */
+    void UnwatchIdle(int fd);
+
+    /**
+     * ExpireIdle shuts down every watched connection that has been idle since before the cutoff. The coroutine
+     * waiting on it reads end of file and closes the connection itself, so the fd is never closed under it.
+     *
+     * @param  cutoff
+     * @return void
+     */
+    void ExpireIdle(std::chrono::steady_clock::time_point cutoff);
+
+private:
+    /**
+     * Wait registers interest in an fd for the waiter, re-arming a previous one shot registration.
+     *
+     * @param  fd
+     * @param  events
+     * @param  waiter
+     * @return void
+     */
+    void Wait(int fd, uint32_t events, ioWaiter* waiter);
+
+    /**
+     * AcceptWaiter returns the waiter of a listening socket, creating it the first time the socket is used.
+     *
+     * @param  listenID
+     * @return ioWaiter&
+     */
+    ioWaiter& AcceptWaiter(int listenID);
+
+    /**
+     * RunPosted resumes everything queued with Post since the last time.
+     *
+     * @param  void
+     * @return void
+     */
+    void RunPosted();
+
+    /**
+     * RunTimers resumes the sleeping coroutines whose deadline has passed and returns the epoll timeout
+     * until the next one, or -1 if none are left.
+     *
+     * @param  void
+     * @return int
+     */
+    int RunTimers();
+
+private:
+    struct timer {
+
+        std::chrono::steady_clock::time_point deadline;
+        std::coroutine_handle<> handle;
+        bool operator>(const timer& other) const { return deadline > other.deadline; }
+    };
+
+    int m_EpollID;
+    int m_WakeID; // eventfd written by Post and Stop
+    std::atomic<bool> m_Running{false};
+
+    // coroutines posted from other threads
+    std::mutex m_PostLock;
+    std::vector<std::coroutine_handle<>> m_Posted;
+
+    std::priority_queue<timer, std::vector<timer>, std::greater<timer>> m_Timers;
+
+    // every listening socket is registered once, these are who is waiting on them and whether they still are
+    std::vector<std::unique_ptr<ioWaiter>> m_AcceptWaiters;
+    std::vector<int> m_Registered;
+
+    // connections waiting for their next request and since when
+    std::unordered_map<int, std::chrono::steady_clock::time_point> m_IdleSince;
+};
+
+#endif // EVENTLOOP_HPP
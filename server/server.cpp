@@ -1,198 +1,1462 @@
 #include "server.hpp"
 
-Server::Server(int port)
-    : m_PortNumber(port)
+namespace
 {
-    const int maxThreads = std::thread::hardware_concurrency();
-    m_ThreadPool.reserve(maxThreads);
+    // the commands that can be requested, indexed by selection - 1
+    const char* const COMMANDS[SHARED_NUM_SLOTS] = { "date", "uptime", "free", "netstat", "who", "ps" };
 
-    // initialize threadpool
-    for(int i = 0; i < maxThreads; i++)
+    // how long a cached output is fresh for
+    constexpr auto CACHE_TTL = std::chrono::milliseconds(1000);
+
+    // scheduling lanes, a request is cheap when it is served from cache or its command runs faster than this
+    constexpr int64_t CHEAP_COST_MICRO = 2000;
+    constexpr int CHEAP_WEIGHT = 4; // cheap jobs dequeued for every expensive one when both lanes are waiting
+    constexpr int MIN_THREADS = 4; // enough workers to keep one reserved for the cheap lane
+
+    // a keep-alive connection without a request for this long is closed, checked every sweep
+    constexpr auto IDLE_TIMEOUT = std::chrono::seconds(30);
+    constexpr auto IDLE_SWEEP = std::chrono::seconds(1);
+
+    // datagrams drained and answered per system call
+    constexpr int UDP_BATCH = 64;
+
+    // snapshot layout, one fixed size record per command so the file can be mapped and indexed
+    constexpr uint32_t SNAPSHOT_MAGIC = 0x534e5031; // "SNP1"
+    constexpr auto SNAPSHOT_MAX_AGE = std::chrono::seconds(60);
+
+    struct snapshotHeader {
+
+        uint32_t magic;
+        uint32_t numEntries;
+        uint32_t entrySize;
+    };
+
+    struct snapshotEntry {
+
+        int64_t wallTime; // system clock ns when the output was produced, the steady clock doesn't survive a reboot
+        int32_t length;
+        char data[1024 * 32];
+    };
+
+    // the node of the calling thread, workers and warm up producers set it to the node they serve
+    thread_local int currentNode = 0;
+
+    // set by the signal handler so AcceptCons can leave its loop
+    volatile sig_atomic_t stopRequested = 0;
+
+    void requestStop(int)
+    {
+        stopRequested = 1;
+    }
+
+    // the size and the output are separate writes, on a kept alive connection Nagle would hold the
+    // output back until the client's delayed ack of the size
+    void disableNagle(int clientID)
+    {
+        int enable = 1;
+        setsockopt(clientID, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+    }
+
+    /**
+     * The poolAwaiter struct runs a job on the thread pool and resumes the awaiting coroutine on its
+     * event loop once the job is done.
+     */
+    struct poolAwaiter {
+
+        Server& server;
+        EventLoop& loop;
+        std::function<void()> job;
+        int lane;
+
+        bool await_ready() noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> handle)
+        {
+            server.AddJobs([this, handle]()
+            {
+                job();
+                loop.Post(handle);
+            }, lane);
+        }
+        void await_resume() noexcept {}
+    };
+
+    bool isHello(const muxHello& hello)
+    {
+        return memcmp(hello.magic, MUX_MAGIC, sizeof(MUX_MAGIC)) == 0 && hello.version > 0;
+    }
+
+    // the answer to a hello, the client may speak a newer version than this server
+    muxAccept acceptHello(const muxHello& hello, int maxInFlight)
+    {
+        muxAccept accept = {};
+        memcpy(accept.hello.magic, MUX_MAGIC, sizeof(MUX_MAGIC));
+        accept.hello.version = std::min(hello.version, MUX_VERSION);
+        accept.maxInFlight = maxInFlight;
+        return accept;
+    }
+
+    // a frame header and its output go out in one system call, a partial write finishes the rest
+    bool sendAll(int clientID, iovec* iov, int count)
     {
-        m_ThreadPool.emplace_back(&Server::GetJobs, this);
+        msghdr message = {};
+        message.msg_iov = iov;
+        message.msg_iovlen = count;
+        while(message.msg_iovlen > 0)
+        {
+            ssize_t numBytes = sendmsg(clientID, &message, MSG_NOSIGNAL);
+            if(numBytes < 0 && errno == EINTR)
+                continue;
+            if(numBytes < 0)
+                return false;
+
+            while(message.msg_iovlen > 0 && size_t(numBytes) >= message.msg_iov->iov_len)
+            {
+                numBytes -= message.msg_iov->iov_len;
+                message.msg_iov++;
+                message.msg_iovlen--;
+            }
+            if(message.msg_iovlen > 0)
+            {
+                message.msg_iov->iov_base = static_cast<char*>(message.msg_iov->iov_base) + numBytes;
+                message.msg_iov->iov_len -= numBytes;
+            }
+        }
+        return true;
     }
 
-    // Create the socket
-    m_ServerID = socket(AF_INET, SOCK_STREAM, 0);
+    /**
+     * The writeTurn struct suspends a coroutine answering a multiplexed request until no other answer
+     * of the connection is being written, endWriteTurn hands the turn to the next one waiting.
+     */
+    struct writeTurn {
+
+        muxSession& session;
+
+        bool await_ready() noexcept { return !std::exchange(session.writing, true); }
+        void await_suspend(std::coroutine_handle<> handle) { session.writers.push_back(handle); }
+        void await_resume() noexcept {}
+    };
+
+    void endWriteTurn(muxSession& session)
+    {
+        if(session.writers.empty())
+        {
+            session.writing = false;
+            return;
+        }
+
+        // the turn passes straight on, so writing stays set
+        session.loop.Post(session.writers.front());
+        session.writers.pop_front();
+    }
+
+    /**
+     * The slotAwaiter struct suspends the reading coroutine of a multiplexed connection until one of its
+     * requests has been answered.
+     */
+    struct slotAwaiter {
+
+        muxSession& session;
+
+        bool await_ready() noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> handle) { session.reader = handle; }
+        void await_resume() noexcept {}
+    };
+}
+
+Server::Server(int port, const serverOptions& options)
+    : m_PortNumber(port), m_Options(options)
+{
+    // fork the helpers first, while this is the only thread and the caches aren't allocated yet
+    if(m_Options.spawnHelpers > 0)
+        m_Spawner = std::make_unique<SpawnPool>(m_Options.spawnHelpers);
+
+    // keep SIGINT and SIGTERM away from the worker threads so they interrupt accept() on the main thread
+    sigset_t stopSignals, oldMask;
+    sigemptyset(&stopSignals);
+    sigaddset(&stopSignals, SIGINT);
+    sigaddset(&stopSignals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stopSignals, &oldMask);
+
+    if(m_Options.sharedCache)
+        m_SharedCache = std::make_unique<SharedCache>(m_Options.sharedCacheName, CACHE_TTL.count());
+
+    // initialize threadpool
+    StartWorkers();
+
+    // Create the socket, a dual stack IPv6 socket accepts IPv4 clients too
+    m_ServerID = socket(AF_INET6, SOCK_STREAM, 0);
+    if(m_ServerID < 0 && errno == EAFNOSUPPORT)
+        m_ServerID = socket(AF_INET, SOCK_STREAM, 0);
     CHK_ERR(m_ServerID, "Creating the socket")
 
+    // a restarted server must be able to bind again while old connections sit in TIME_WAIT
+    int enable = 1;
+    CHK_ERR(setsockopt(m_ServerID, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable)),
+            "Setting SO_REUSEADDR on the socket")
+
+    if(m_Options.reusePort)
+    {
+        CHK_ERR(setsockopt(m_ServerID, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)),
+                "Setting SO_REUSEPORT on the socket")
+    }
+
     // Bind ip and port to socket
     memset(&m_ServerAddress, 0, sizeof(m_ServerAddress));
-    m_ServerAddress.sin_family = AF_INET; // IPv4
-    m_ServerAddress.sin_port = htons(m_PortNumber); // Fix endianness
-    m_ServerAddress.sin_addr.s_addr = INADDR_ANY; // Sets to address of machine
+    socklen_t addressLength;
+    int family = AF_INET;
+    socklen_t familyLength = sizeof(family);
+    getsockopt(m_ServerID, SOL_SOCKET, SO_DOMAIN, &family, &familyLength);
+    if(family == AF_INET6)
+    {
+        int disable = 0;
+        CHK_ERR(setsockopt(m_ServerID, IPPROTO_IPV6, IPV6_V6ONLY, &disable, sizeof(disable)),
+                "Clearing IPV6_V6ONLY on the socket")
 
-    CHK_ERR(bind(m_ServerID, (sockaddr*)&m_ServerAddress, sizeof(m_ServerAddress)),
+        sockaddr_in6& address = reinterpret_cast<sockaddr_in6&>(m_ServerAddress);
+        address.sin6_family = AF_INET6;
+        address.sin6_port = htons(m_PortNumber); // Fix endianness
+        address.sin6_addr = in6addr_any; // Sets to address of machine
+        addressLength = sizeof(sockaddr_in6);
+    }
+    else
+    {
+        sockaddr_in& address = reinterpret_cast<sockaddr_in&>(m_ServerAddress);
+        address.sin_family = AF_INET; // IPv4
+        address.sin_port = htons(m_PortNumber); // Fix endianness
+        address.sin_addr.s_addr = INADDR_ANY; // Sets to address of machine
+        addressLength = sizeof(sockaddr_in);
+    }
+
+    CHK_ERR(bind(m_ServerID, (sockaddr*)&m_ServerAddress, addressLength),
             "Binding of address to socket")
 
+    // datagram sockets on the same port, SO_REUSEPORT lets the kernel spread clients over their threads
+    for(int i = 0; i < m_Options.udpThreads; i++)
+    {
+        int udpID = socket(family, SOCK_DGRAM, 0);
+        CHK_ERR(udpID, "Creating a datagram socket")
+        CHK_ERR(setsockopt(udpID, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)),
+                "Setting SO_REUSEPORT on the datagram socket")
+        if(family == AF_INET6)
+        {
+            int disable = 0;
+            CHK_ERR(setsockopt(udpID, IPPROTO_IPV6, IPV6_V6ONLY, &disable, sizeof(disable)),
+                    "Clearing IPV6_V6ONLY on the datagram socket")
+        }
+        CHK_ERR(bind(udpID, (sockaddr*)&m_ServerAddress, addressLength), "Binding of the datagram socket")
+
+        // room for bursts while the thread answers the previous batch, the kernel caps it at rmem_max
+        int bufferSize = 4 * 1024 * 1024;
+        setsockopt(udpID, SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize));
+        m_UdpIDs.push_back(udpID);
+    }
+
+    // same host clients can skip the TCP stack
+    if(!m_Options.unixPath.empty())
+    {
+        sockaddr_un unixAddress;
+        memset(&unixAddress, 0, sizeof(unixAddress));
+        unixAddress.sun_family = AF_UNIX;
+        if(m_Options.unixPath.size() >= sizeof(unixAddress.sun_path))
+        {
+            std::cerr << "ERROR: Unix socket path " << m_Options.unixPath << " is too long.\n";
+            exit(0);
+        }
+        strncpy(unixAddress.sun_path, m_Options.unixPath.c_str(), sizeof(unixAddress.sun_path) - 1);
+
+        m_UnixID = socket(AF_UNIX, SOCK_STREAM, 0);
+        CHK_ERR(m_UnixID, "Creating the Unix domain socket")
+
+        // a socket file left behind by a server that didn't shut down cleanly would fail the bind
+        unlink(m_Options.unixPath.c_str());
+        CHK_ERR(bind(m_UnixID, (sockaddr*)&unixAddress, sizeof(unixAddress)),
+                "Binding of the Unix domain socket")
+    }
+
+    // Fill every cache before anyone can connect so the first burst doesn't all run a command
+    WarmCache();
+
+    // start the trace once warm so it only holds client traffic
+    if(!m_Options.tracePath.empty())
+        m_Tracer = std::make_unique<Tracer>(m_Options.tracePath);
 
     // Listen to the socket for connections
     CHK_ERR(listen(m_ServerID, SOMAXCONN), "Setting the socket to listen")
+    if(m_UnixID >= 0)
+    {
+        CHK_ERR(listen(m_UnixID, SOMAXCONN), "Setting the Unix domain socket to listen")
+    }
+
+    // the ring thread starts while the stop signals are still blocked so it never receives them
+    if(!m_Options.ringName.empty())
+    {
+        m_Ring = std::make_unique<RequestRing>(m_Options.ringName, m_Options.sharedCacheName);
+        m_RingThread = std::thread(&Server::ServeRing, this);
+    }
+    for(int udpID : m_UdpIDs)
+        m_UdpThreads.emplace_back(&Server::ServeDatagrams, this, udpID);
+
+    // no SA_RESTART so a blocked accept() returns EINTR
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = requestStop;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+    pthread_sigmask(SIG_SETMASK, &oldMask, nullptr);
 }
 
 void Server::AcceptCons()
 {
-    // clear the array initially
-    m_MsgBuffer.fill('\0');
+    if(m_Options.eventLoops > 0)
+    {
+        RunEventLoops();
+        return;
+    }
+
+    // wait on the listening socket and the idle keep-alive connections at once, a worker never blocks on an idle client
+    m_IdleID = epoll_create1(EPOLL_CLOEXEC);
+    CHK_ERR(m_IdleID, "Creating the idle connection set")
+
+    epoll_event listenEvent = {};
+    listenEvent.events = EPOLLIN;
+    listenEvent.data.fd = m_ServerID;
+    CHK_ERR(epoll_ctl(m_IdleID, EPOLL_CTL_ADD, m_ServerID, &listenEvent), "Watching the listening socket")
+    if(m_UnixID >= 0)
+    {
+        listenEvent.data.fd = m_UnixID;
+        CHK_ERR(epoll_ctl(m_IdleID, EPOLL_CTL_ADD, m_UnixID, &listenEvent), "Watching the Unix domain socket")
+    }
+
+    // the idle connections are swept from the same thread that hands them out, so none is in use when expired
+    m_SweepID = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    CHK_ERR(m_SweepID, "Creating the idle sweep timer")
+    itimerspec sweep = {};
+    sweep.it_interval.tv_sec = IDLE_SWEEP.count();
+    sweep.it_value = sweep.it_interval;
+    CHK_ERR(timerfd_settime(m_SweepID, 0, &sweep, nullptr), "Starting the idle sweep timer")
+    listenEvent.data.fd = m_SweepID;
+    CHK_ERR(epoll_ctl(m_IdleID, EPOLL_CTL_ADD, m_SweepID, &listenEvent), "Watching the idle sweep timer")
 
     // main loop
+    std::array<epoll_event, 64> events;
+    std::cout << "Listening for connections...\n";
+    while(!stopRequested)
+    {
+        int ready = epoll_wait(m_IdleID, events.data(), events.size(), -1);
+        if(ready < 0 && errno == EINTR)
+            continue; // check if we were asked to stop
+        CHK_ERR(ready, "Waiting for connections")
+
+        bool sweepDue = false;
+        for(int i = 0; i < ready; i++)
+        {
+            int clientID = events[i].data.fd;
+            if(clientID == m_SweepID)
+            {
+                // after the batch, a connection handed out below is no longer idle
+                uint64_t expirations;
+                read(m_SweepID, &expirations, sizeof(expirations));
+                sweepDue = true;
+                continue;
+            }
+            else if(clientID == m_ServerID || clientID == m_UnixID)
+            {
+                const int listenID = clientID;
+
+                // Clear the buffers and sockaddrs
+                memset(&m_ClientAddress, 0, sizeof(m_ClientAddress));
+
+                // Accept connections
+                m_ClientAddrLength = sizeof(m_ClientAddress);
+                clientID = accept(listenID, (sockaddr*)&m_ClientAddress, &m_ClientAddrLength);
+                if(clientID < 0 && errno == EINTR)
+                    continue;
+                std::cout << "Connection Accepted.\n";
+                CHK_ERR(clientID, "accepting a connection")
+                if(listenID == m_ServerID)
+                    disableNagle(clientID);
+            }
+            else
+            {
+                std::lock_guard<std::mutex> lock(m_IdleLock);
+                m_IdleSince.erase(clientID);
+            }
+
+            // add the new or readable connection to thread pool, spreading connections over the nodes
+            AddJobs(std::bind(&Server::HandleConn, this, clientID, std::chrono::steady_clock::now()), LANE_CHEAP, m_NextNode);
+            m_NextNode = (m_NextNode + 1) % m_Nodes.size();
+        }
+
+        if(sweepDue)
+            ExpireIdle();
+    }
+    std::cout << "Shutting down.\n";
+}
+
+void Server::RunEventLoops()
+{
+    int flags = fcntl(m_ServerID, F_GETFL);
+    CHK_ERR(fcntl(m_ServerID, F_SETFL, flags | O_NONBLOCK), "Making the socket non-blocking")
+    if(m_UnixID >= 0)
+    {
+        flags = fcntl(m_UnixID, F_GETFL);
+        CHK_ERR(fcntl(m_UnixID, F_SETFL, flags | O_NONBLOCK), "Making the Unix domain socket non-blocking")
+    }
+
+    // the loop threads inherit the blocked signals so they are delivered to the waiting main thread
+    sigset_t stopSignals, oldMask;
+    sigemptyset(&stopSignals);
+    sigaddset(&stopSignals, SIGINT);
+    sigaddset(&stopSignals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stopSignals, &oldMask);
+
+    std::vector<std::thread> loopThreads;
+    for(int i = 0; i < m_Options.eventLoops; i++)
+    {
+        m_Loops.push_back(std::make_unique<EventLoop>());
+        EventLoop& loop = *m_Loops.back();
+        loopThreads.emplace_back([this, &loop]()
+        {
+            loop.Spawn(AcceptLoop(loop, m_ServerID));
+            if(m_UnixID >= 0)
+                loop.Spawn(AcceptLoop(loop, m_UnixID));
+            loop.Spawn(ExpireIdleAsync(loop));
+            loop.Run();
+        });
+    }
+    std::cout << "Listening for connections on " << m_Options.eventLoops << " event loops...\n";
+
+    while(!stopRequested)
+        sigsuspend(&oldMask);
+    pthread_sigmask(SIG_SETMASK, &oldMask, nullptr);
+    std::cout << "Shutting down.\n";
+
+    for(auto& loop : m_Loops)
+        loop->Stop();
+    for(auto& t : loopThreads)
+        t.join();
+}
+
+Task<> Server::AcceptLoop(EventLoop& loop, int listenID)
+{
     while(true)
     {
-        // Clear the buffers and sockaddrs
-        memset(&m_ClientAddress, 0, sizeof(m_ClientAddress));
+        int clientID = co_await loop.AsyncAccept(listenID);
+        if(clientID < 0)
+        {
+            // out of fds or similar, back off instead of spinning on the listening socket
+            std::cerr << "ERROR #" << errno << ": accepting a connection failed.\n";
+            co_await loop.SleepFor(std::chrono::milliseconds(10));
+            continue;
+        }
+
+        if(listenID == m_ServerID)
+            disableNagle(clientID);
+        loop.Spawn(HandleConnAsync(loop, clientID, std::chrono::steady_clock::now()));
+    }
+}
+
+Task<> Server::ExpireIdleAsync(EventLoop& loop)
+{
+    while(true)
+    {
+        co_await loop.SleepFor(IDLE_SWEEP);
+        loop.ExpireIdle(std::chrono::steady_clock::now() - IDLE_TIMEOUT);
+    }
+}
+
+Task<> Server::HandleConnAsync(EventLoop& loop, int clientID, std::chrono::steady_clock::time_point arrival)
+{
+    // the frame comes from the coroutine frame pool so the buffer costs no allocation
+    std::array<char, 1024 * 32> msgBuffer;
+    bool keepAlive = true;
+    for(int served = 0; keepAlive && m_Running; served++)
+    {
+        // expired if the selection takes too long
+        int selection;
+        loop.WatchIdle(clientID);
+        ssize_t numBytes = co_await loop.AsyncReadExact(clientID, &selection, sizeof(selection));
+        loop.UnwatchIdle(clientID);
+        if(numBytes <= 0)
+            break;
+
+        muxHello hello;
+        memcpy(&hello, &selection, sizeof(hello));
+        if(served == 0 && isHello(hello))
+        {
+            co_await ServeMuxAsync(loop, clientID, hello);
+            break;
+        }
 
-        // Accept connections
-        m_ClientAddrLength = sizeof(m_ClientAddress);
-        std::cout << "Listening for connections...\n";
-        int clientID = accept(m_ServerID, (sockaddr*)&m_ClientAddress, &m_ClientAddrLength);
-        std::cout << "Connection Accepted.\n";
-        CHK_ERR(clientID, "accepting a connection")
+        // the later requests of a keep-alive connection arrive when their selection does
+        if(served > 0)
+            arrival = std::chrono::steady_clock::now();
+        keepAlive = selection & KEEP_ALIVE_FLAG;
+        selection &= ~KEEP_ALIVE_FLAG;
 
-        // add new connection to thread pool
-        AddJobs(std::bind(&Server::HandleConn, this, clientID));
+        // only a fresh output is answered on the loop, running or waiting for a command would stall every connection on it
+        std::chrono::steady_clock::time_point serviceStart = std::chrono::steady_clock::now();
+        int msgLen = ReadCached(msgBuffer, selection);
+        if(msgLen < 0)
+        {
+            // named rather than a temporary, g++ 12 destroys temporaries holding a std::function twice across co_await
+            poolAwaiter offload{ *this, loop, [&]()
+            {
+                serviceStart = std::chrono::steady_clock::now();
+                msgLen = SelectCommand(msgBuffer, selection);
+            }, IsCheap(selection) ? LANE_CHEAP : LANE_EXPENSIVE };
+            co_await offload;
+        }
+
+        // send initial size incase it neads to be read in chunks
+        if(co_await loop.AsyncWriteAll(clientID, &msgLen, sizeof(msgLen)) < 0
+           || co_await loop.AsyncWriteAll(clientID, &msgBuffer[0], msgLen) < 0)
+            keepAlive = false;
+
+        if(m_Tracer)
+            m_Tracer->Record(selection, arrival, serviceStart, std::chrono::steady_clock::now());
     }
+
+    close(clientID);
 }
 
-void Server::AddJobs(std::function<void()> f)
+Task<> Server::ServeMuxAsync(EventLoop& loop, int clientID, muxHello hello)
 {
+    muxAccept accept = acceptHello(hello, MUX_MAX_IN_FLIGHT);
+    if(co_await loop.AsyncWriteAll(clientID, &accept, sizeof(accept)) < 0)
+        co_return;
+
+    muxSession session{ loop, clientID, dup(clientID) };
+    if(session.writeID < 0)
+        co_return;
+
+    while(!session.broken)
     {
-        // add job to job queue
-        std::unique_lock<std::mutex> queueLock(m_QueueLock);
-        m_JobQueue.push(std::move(f));
+        // past the limit the requests stay in the socket buffer until an answer frees a slot
+        while(session.inFlight >= MUX_MAX_IN_FLIGHT)
+            co_await slotAwaiter{ session };
+
+        // only idle without answers in flight, a client waiting for one isn't expected to send anything
+        muxRequest request;
+        if(session.inFlight == 0)
+            loop.WatchIdle(clientID);
+        ssize_t numBytes = co_await loop.AsyncReadExact(clientID, &request, sizeof(request));
+        loop.UnwatchIdle(clientID);
+        if(numBytes <= 0)
+            break;
+
+        session.inFlight++;
+        loop.Spawn(ServeFrameAsync(session, request, std::chrono::steady_clock::now()));
+    }
+
+    // the requests still being answered point at the session
+    while(session.inFlight > 0)
+        co_await slotAwaiter{ session };
+    close(session.writeID);
+}
+
+Task<> Server::ServeFrameAsync(muxSession& session, muxRequest request, std::chrono::steady_clock::time_point arrival)
+{
+    std::array<char, 1024 * 32> msgBuffer;
+    std::chrono::steady_clock::time_point serviceStart = std::chrono::steady_clock::now();
+    int msgLen = ReadCached(msgBuffer, request.selection);
+    if(msgLen < 0)
+    {
+        poolAwaiter offload{ *this, session.loop, [&]()
+        {
+            serviceStart = std::chrono::steady_clock::now();
+            msgLen = SelectCommand(msgBuffer, request.selection);
+        }, IsCheap(request.selection) ? LANE_CHEAP : LANE_EXPENSIVE };
+        co_await offload;
+    }
+
+    // a frame is written in one turn so the answers of the connection don't interleave
+    co_await writeTurn{ session };
+    muxResponse response = { request.id, msgLen };
+    if(!session.broken
+       && (co_await session.loop.AsyncWriteAll(session.writeID, &response, sizeof(response)) < 0
+           || co_await session.loop.AsyncWriteAll(session.writeID, &msgBuffer[0], msgLen) < 0))
+    {
+        // wakes the reader, which stops taking requests
+        session.broken = true;
+        shutdown(session.clientID, SHUT_RDWR);
+    }
+    endWriteTurn(session);
+
+    if(m_Tracer)
+        m_Tracer->Record(request.selection, arrival, serviceStart, std::chrono::steady_clock::now());
+
+    session.inFlight--;
+    if(session.reader)
+        session.loop.Post(std::exchange(session.reader, nullptr));
+    else if(session.inFlight == 0)
+        session.loop.WatchIdle(session.clientID); // the reader is waiting for a request with nothing left to answer
+}
+
+void Server::AddJobs(std::function<void()> f, int lane, int node)
+{
+    jobQueue& queue = m_Nodes[node < 0 ? currentNode : node]->queue;
+    {
+        // add job to the lane's job queue
+        std::unique_lock<std::mutex> queueLock(queue.lock);
+        queue.lanes[lane].push(std::move(f));
     }
     // let threads know there is a new connection
-    m_JobCondition.notify_one();
+    queue.condition.notify_one();
 }
 
-void Server::GetJobs()
+void Server::GetJobs(int node)
 {
-    while(m_Running)
+    currentNode = node;
+    jobQueue& queue = m_Nodes[node]->queue;
+
+    while(true)
     {
+        std::function<void()> job;
+        int lane = LANE_CHEAP;
         {
-            std::unique_lock<std::mutex> queueLock(m_QueueLock);
-            std::function<void()> job;
-            if(!m_JobQueue.empty())
+            std::unique_lock<std::mutex> queueLock(queue.lock);
+            auto canRunExpensive = [&](){return !queue.lanes[LANE_EXPENSIVE].empty() && queue.expensiveRunning < queue.maxExpensive;};
+            std::function<bool()> pred = [&](){
+                return !queue.lanes[LANE_CHEAP].empty() || canRunExpensive()
+                    || (!m_Running && queue.lanes[LANE_EXPENSIVE].empty());
+            };
+            queue.condition.wait(queueLock, pred);
+
+            // only stop once the remaining jobs are done
+            bool hasCheap = !queue.lanes[LANE_CHEAP].empty();
+            if(!hasCheap && !canRunExpensive())
+                return;
+
+            // weighted fair pick, an expensive job gets its turn after CHEAP_WEIGHT cheap ones
+            if(canRunExpensive() && (!hasCheap || queue.cheapStreak >= CHEAP_WEIGHT))
             {
-                job = std::move(m_JobQueue.front());
-                m_JobQueue.pop();
-                job();
+                lane = LANE_EXPENSIVE;
+                queue.cheapStreak = 0;
+                queue.expensiveRunning++;
             }
             else
+                queue.cheapStreak++;
+
+            job = std::move(queue.lanes[lane].front());
+            queue.lanes[lane].pop();
+        }
+        // run the job outside the lock so the other threads can pick up jobs meanwhile
+        job();
+
+        if(lane == LANE_EXPENSIVE)
+        {
             {
-                std::function<bool()> pred = [&](){return !m_JobQueue.empty();};
-                m_JobCondition.wait(queueLock, pred);
-            }       
+                std::lock_guard<std::mutex> queueLock(queue.lock);
+                queue.expensiveRunning--;
+            }
+            // a waiting expensive job may be allowed to start now
+            queue.condition.notify_one();
         }
     }
 }
 
-void Server::HandleConn(int clientID)
+void Server::StartWorkers()
+{
+    std::vector<std::vector<int>> nodeCpus;
+    if(m_Options.numa)
+        nodeCpus = getNumaNodes();
+    else
+        nodeCpus.push_back(getAllowedCpus());
+
+    for(const std::vector<int>& cpus : nodeCpus)
+    {
+        // allocate each node from one of its own CPUs so first touch puts its queue and cache in local memory
+        std::unique_ptr<workerNode> node;
+        std::thread([&]()
+        {
+            if(m_Options.numa)
+                pinThread(pthread_self(), cpus);
+            node = std::make_unique<workerNode>();
+        }).join();
+        node->cpus = cpus;
+        m_Nodes.push_back(std::move(node));
+    }
+
+    for(int n = 0; n < int(m_Nodes.size()); n++)
+    {
+        workerNode& node = *m_Nodes[n];
+        const int numCpus = node.cpus.empty() ? int(std::thread::hardware_concurrency()) : int(node.cpus.size());
+        const int maxThreads = std::max(numCpus, MIN_THREADS);
+
+        // every answer of a blocking multiplexed connection holds a worker while it is written, a client that
+        // stops reading must not be able to hold all of them
+        m_MuxInFlight = std::clamp(maxThreads / 2, 1, std::min(m_MuxInFlight, MUX_MAX_IN_FLIGHT));
+
+        // a quarter of the workers, at least one, never pick up expensive jobs
+        node.queue.maxExpensive = maxThreads - std::max(1, maxThreads / 4);
+
+        for(int i = 0; i < maxThreads; i++)
+        {
+            m_ThreadPool.emplace_back(&Server::GetJobs, this, n);
+            if(node.cpus.empty())
+                continue;
+
+            if(m_Options.pinCpus)
+                pinThread(m_ThreadPool.back().native_handle(), { node.cpus[i % node.cpus.size()] });
+            else if(m_Options.numa)
+                pinThread(m_ThreadPool.back().native_handle(), node.cpus);
+        }
+    }
+}
+
+void Server::HandleConn(int clientID, std::chrono::steady_clock::time_point arrival)
 { 
+    // a multiplexed connection that became readable again
+    std::shared_ptr<muxConnection> conn;
+    {
+        std::lock_guard<std::mutex> lock(m_MuxLock);
+        auto found = m_MuxConns.find(clientID);
+        if(found != m_MuxConns.end())
+            conn = found->second;
+    }
+    if(conn)
+    {
+        ReadFrames(conn);
+        return;
+    }
+
     int selection;
     int numBytes = read(clientID, &selection, sizeof(int));
-    CHK_ERR(numBytes, "Reading data from client")
-    SelectCommand(m_MsgBuffer, selection);
-    // std::cout << "Bytes Read: " << numBytes << '\n';
+    if(numBytes < int(sizeof(int)))
+    {
+        // the client hung up, which is how every keep-alive connection ends
+        close(clientID);
+        return;
+    }
+
+    muxHello hello;
+    memcpy(&hello, &selection, sizeof(hello));
+    if(isHello(hello))
+    {
+        muxAccept accept = acceptHello(hello, m_MuxInFlight);
+        iovec iov = { &accept, sizeof(accept) };
+        if(!sendAll(clientID, &iov, 1))
+        {
+            close(clientID);
+            return;
+        }
+
+        conn = std::make_shared<muxConnection>();
+        conn->clientID = clientID;
+        {
+            std::lock_guard<std::mutex> lock(m_MuxLock);
+            m_MuxConns[clientID] = conn;
+        }
+        std::cout << "Connection multiplexed.\n";
+        ReadFrames(conn);
+        return;
+    }
+
+    bool keepAlive = selection & KEEP_ALIVE_FLAG;
+    selection &= ~KEEP_ALIVE_FLAG;
+
+    // cache misses of slow commands wait in their own lane so they don't hold up cheap requests
+    if(IsCheap(selection))
+        SendResponse(clientID, selection, arrival, keepAlive);
+    else
+        AddJobs(std::bind(&Server::SendResponse, this, clientID, selection, arrival, keepAlive), LANE_EXPENSIVE);
+}
+
+void Server::SendResponse(int clientID, int selection, std::chrono::steady_clock::time_point arrival, bool keepAlive)
+{
+    auto serviceStart = std::chrono::steady_clock::now();
+
+    // copy the output out of the cache so no lock is held while writing to the client
+    std::array<char, 1024 * 32> msgBuffer;
+    int msgLen = SelectCommand(msgBuffer, selection);
 
-    // send initial size incase it neads to be read in chunks
+    // send initial size incase it neads to be read in chunks, both in one call. A client that hung up,
+    // as pooled clients do with idle connections, only costs its own connection
+    iovec iov[2] = { { &msgLen, sizeof(msgLen) }, { &msgBuffer[0], size_t(msgLen) } };
+    if(!sendAll(clientID, iov, 2))
     {
-        std::lock_guard<std::mutex> lock(m_MsgLock);
-        int msgLen = strlen(m_MsgBuffer.begin());
-        numBytes = write(clientID, &msgLen, sizeof(msgLen));
+        std::cout << "Client hung up before the response was sent.\n";
+        close(clientID);
+        return;
+    }
+    const int numBytes = msgLen;
+
+    if(m_Tracer)
+        m_Tracer->Record(selection, arrival, serviceStart, std::chrono::steady_clock::now());
 
-        numBytes = write(clientID, &m_MsgBuffer[0], msgLen); 
-        CHK_ERR(numBytes, "Writing data to client")
-       
-        // printf("Response: \n%s\nClosing Connection.\n", m_MsgBuffer.begin());
+    // hand the connection back to the accepting thread until the next selection arrives
+    if(keepAlive && RearmIdle(clientID))
+    {
+        std::cout << "Bytes Sent: " << numBytes << "\nConnection kept alive.\n";
+        return;
     }
+
     std::cout << "Bytes Sent: " << numBytes << "\nConnection closed.\n";
+    close(clientID);
+}
+
+void Server::ReadFrames(const std::shared_ptr<muxConnection>& conn)
+{
+    // only read as many requests as there are free slots, the rest wait in the socket buffer
+    int slots;
+    {
+        std::lock_guard<std::mutex> lock(conn->lock);
+        slots = m_MuxInFlight - conn->inFlight;
+        if(slots <= 0)
+        {
+            conn->paused = true;
+            return;
+        }
+    }
+
+    std::array<char, sizeof(muxRequest) * MUX_MAX_IN_FLIGHT> frames;
+    memcpy(&frames[0], conn->partial, conn->partialBytes);
+    ssize_t numBytes;
+    do
+        numBytes = recv(conn->clientID, &frames[conn->partialBytes], slots * sizeof(muxRequest) - conn->partialBytes, MSG_DONTWAIT);
+    while(numBytes < 0 && errno == EINTR);
+
+    if(numBytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        numBytes = 0; // woken up for nothing, wait for the next request
+    else if(numBytes <= 0)
+    {
+        // the client hung up, the fd is closed once the answers still in flight are written
+        {
+            std::lock_guard<std::mutex> lock(conn->lock);
+            conn->closed = true;
+        }
+        std::lock_guard<std::mutex> lock(m_MuxLock);
+        m_MuxConns.erase(conn->clientID);
+        std::cout << "Connection closed.\n";
+        return;
+    }
+
+    const size_t total = conn->partialBytes + numBytes;
+    const int count = total / sizeof(muxRequest);
+    conn->partialBytes = total % sizeof(muxRequest);
+    memcpy(conn->partial, &frames[count * sizeof(muxRequest)], conn->partialBytes);
+    {
+        std::lock_guard<std::mutex> lock(conn->lock);
+        conn->inFlight += count;
+    }
+
+    // a cheap request is answered before the expensive ones read with it
+    auto arrival = std::chrono::steady_clock::now();
+    for(int i = 0; i < count; i++)
+    {
+        muxRequest request;
+        memcpy(&request, &frames[i * sizeof(muxRequest)], sizeof(request));
+        if(IsCheap(request.selection))
+            SendFrame(conn, request, arrival);
+        else
+            AddJobs(std::bind(&Server::SendFrame, this, conn, request, arrival), LANE_EXPENSIVE);
+    }
+
+    // more requests may be waiting, the idle set hands them to whichever worker is free
+    std::lock_guard<std::mutex> lock(conn->lock);
+    if(conn->inFlight >= m_MuxInFlight)
+        conn->paused = true;
+    else if(!RearmIdle(conn->clientID))
+        shutdown(conn->clientID, SHUT_RDWR);
+}
+
+void Server::SendFrame(const std::shared_ptr<muxConnection>& conn, muxRequest request, std::chrono::steady_clock::time_point arrival)
+{
+    auto serviceStart = std::chrono::steady_clock::now();
+
+    std::array<char, 1024 * 32> msgBuffer;
+    muxResponse response = { request.id, SelectCommand(msgBuffer, request.selection) };
+    iovec iov[2] = { { &response, sizeof(response) }, { &msgBuffer[0], size_t(response.length) } };
+    {
+        std::lock_guard<std::mutex> lock(conn->writeLock);
+        if(!sendAll(conn->clientID, iov, 2))
+            shutdown(conn->clientID, SHUT_RDWR); // the reader sees the hang up and drops the connection
+    }
+
+    if(m_Tracer)
+        m_Tracer->Record(request.selection, arrival, serviceStart, std::chrono::steady_clock::now());
+
+    // a reader stopped at the limit can go on now
+    std::lock_guard<std::mutex> lock(conn->lock);
+    conn->inFlight--;
+    if(conn->paused && !conn->closed)
+    {
+        conn->paused = false;
+        if(!RearmIdle(conn->clientID))
+            shutdown(conn->clientID, SHUT_RDWR);
+    }
+}
+
+bool Server::RearmIdle(int clientID)
+{
+    // stamped before arming, the accepting thread may hand the connection out again right away
+    {
+        std::lock_guard<std::mutex> lock(m_IdleLock);
+        m_IdleSince[clientID] = std::chrono::steady_clock::now();
+    }
+
+    epoll_event event = {};
+    event.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+    event.data.fd = clientID;
+    if(epoll_ctl(m_IdleID, EPOLL_CTL_MOD, clientID, &event) == 0
+       || (errno == ENOENT && epoll_ctl(m_IdleID, EPOLL_CTL_ADD, clientID, &event) == 0))
+        return true;
+
+    // the caller closes it, the sweep must not find the fd
+    std::lock_guard<std::mutex> lock(m_IdleLock);
+    m_IdleSince.erase(clientID);
+    return false;
+}
+
+void Server::ExpireIdle()
+{
+    std::vector<int> expired;
+    {
+        auto cutoff = std::chrono::steady_clock::now() - IDLE_TIMEOUT;
+        std::lock_guard<std::mutex> lock(m_IdleLock);
+        for(auto it = m_IdleSince.begin(); it != m_IdleSince.end(); )
+        {
+            if(it->second < cutoff)
+            {
+                expired.push_back(it->first);
+                it = m_IdleSince.erase(it);
+            }
+            else
+                ++it;
+        }
+    }
+
+    for(int clientID : expired)
+    {
+        std::shared_ptr<muxConnection> conn;
+        {
+            std::lock_guard<std::mutex> lock(m_MuxLock);
+            auto found = m_MuxConns.find(clientID);
+            if(found != m_MuxConns.end())
+                conn = found->second;
+        }
+        if(conn)
+        {
+            std::lock_guard<std::mutex> lock(conn->lock);
+            if(conn->inFlight > 0)
+            {
+                // still armed, it comes up again once the answers are written and the client goes quiet
+                std::lock_guard<std::mutex> idleLock(m_IdleLock);
+                m_IdleSince.emplace(clientID, std::chrono::steady_clock::now());
+                continue;
+            }
+        }
+
+        // wakes the connection in the idle set, the worker reading it sees the hang up and closes it
+        std::cout << "Idle connection timed out.\n";
+        shutdown(clientID, SHUT_RDWR);
+    }
 }
 
 void Server::ShutDown()
 {
     close(m_ServerID);
+    if(m_UnixID >= 0)
+    {
+        close(m_UnixID);
+        unlink(m_Options.unixPath.c_str());
+    }
+
+    // shutting a datagram socket down wakes its blocked recvmmsg
+    for(int udpID : m_UdpIDs)
+        shutdown(udpID, SHUT_RDWR);
+    for(auto& t : m_UdpThreads)
+        t.join();
+
+    // stop taking ring requests, the ones already handed to the workers still complete below
+    if(m_Ring)
+    {
+        m_Ring->Stop();
+        m_RingThread.join();
+    }
 
     // thread clean up
-    std::lock_guard<std::mutex> lock(m_PoolLock);
     m_Running = false;
-    m_JobCondition.notify_all(); // let all threads know to stop waiting on jobs
+    for(auto& node : m_Nodes)
+    {
+        // taking the lock makes sure no worker is between checking m_Running and going to sleep
+        { std::lock_guard<std::mutex> lock(node->queue.lock); }
+        node->queue.condition.notify_all(); // let all threads know to stop waiting on jobs
+    }
 
     for(auto& t : m_ThreadPool)
         t.join(); // ensure all threads are finished before destroying server
+
+    // nothing posts to the loops anymore, let the coroutines the pool finished for answer and close
+    for(auto& loop : m_Loops)
+        loop->Drain();
+    m_Loops.clear();
+
+    if(m_IdleID >= 0)
+        close(m_IdleID);
+    if(m_SweepID >= 0)
+        close(m_SweepID);
+
+    // the expensive datagram answers are sent, the sockets can go
+    for(int udpID : m_UdpIDs)
+        close(udpID);
+
+    if(!m_Options.snapshotPath.empty())
+        SaveSnapshot();
+
+    // closing the trace writes out the last batch
+    m_Tracer.reset();
+    m_Ring.reset();
+    m_Spawner.reset();
 }
 
-void Server::SelectCommand(std::array<char, 1024 * 32>& msgBuffer, int userSelection)
+void Server::ServeRing()
 {
+    uint32_t position;
+    int selection;
+    while(m_Ring->Pop(position, selection))
     {
-        std::lock_guard<std::mutex> lockTime(m_TimePointLock);
+        auto arrival = std::chrono::steady_clock::now();
 
-        // Check cache
-        if(userSelection == m_LastSelection)
+        // a fresh slot is already the response, the client copies it out of the shared cache itself
+        bool valid = selection >= 1 && selection <= SHARED_NUM_SLOTS;
+        if(!valid || m_SharedCache->IsFresh(selection - 1))
         {
-            // check if it has been one minute
-            auto endTimePoint = std::chrono::steady_clock::now();
-            auto end = std::chrono::time_point_cast<std::chrono::milliseconds>(endTimePoint);
-            auto start = std::chrono::time_point_cast<std::chrono::milliseconds>(m_TimePoint);
-
-            auto diff = end - start;
-            
-            // if last cache was made less than one second ago, use cache
-            if(diff.count() < 1000)
-                return;
+            m_Ring->Complete(position);
+            if(m_Tracer)
+                m_Tracer->Record(selection, arrival, arrival, std::chrono::steady_clock::now());
         }
+        else
+        {
+            // the ring thread never runs a command itself, a stale slot is refreshed on the pool
+            AddJobs([this, position, selection, arrival]()
+            {
+                auto serviceStart = std::chrono::steady_clock::now();
+                std::array<char, 1024 * 32> output;
+                SelectCommand(output, selection);
+                m_Ring->Complete(position);
+                if(m_Tracer)
+                    m_Tracer->Record(selection, arrival, serviceStart, std::chrono::steady_clock::now());
+            }, IsCheap(selection) ? LANE_CHEAP : LANE_EXPENSIVE);
+        }
+    }
+}
+
+void Server::ServeDatagrams(int udpID)
+{
+    // one batch worth of requests, answers and their addresses, reused for every batch
+    std::array<udpRequest, UDP_BATCH> requests;
+    std::array<sockaddr_storage, UDP_BATCH> addresses;
+    std::array<iovec, UDP_BATCH> requestVecs;
+    std::array<mmsghdr, UDP_BATCH> received;
 
-        // else we update user selection and time stamp new cache
-        m_LastSelection = userSelection;
-        m_TimePoint = std::chrono::steady_clock::now();
-    }
-
-    switch (userSelection)
-    {
-    case 1:
-        HandleCommand(msgBuffer, "date");
-        break;
-    case 2:
-         HandleCommand(msgBuffer, "uptime");
-        break;
-    case 3:
-        HandleCommand(msgBuffer, "free");
-        break;
-    case 4:
-         HandleCommand(msgBuffer, "netstat");
-        break;
-    case 5:
-         HandleCommand(msgBuffer, "who");
-        break;
-    case 6:
-         HandleCommand(msgBuffer, "ps");
-        break;
-    default:
-        {
-            std::lock_guard<std::mutex> lock(m_MsgLock);
-            snprintf(&msgBuffer[0], msgBuffer.size() - 1, "ERROR: invalid selection.");
+    std::array<udpResponse, UDP_BATCH> responses;
+    std::array<std::array<char, UDP_MAX_PAYLOAD>, UDP_BATCH> payloads;
+    std::array<std::array<iovec, 2>, UDP_BATCH> responseVecs;
+    std::array<mmsghdr, UDP_BATCH> answers;
+    std::array<int, UDP_BATCH> selections;
+
+    std::array<char, 1024 * 32> msgBuffer;
+
+    memset(received.data(), 0, sizeof(received));
+    memset(answers.data(), 0, sizeof(answers));
+    for(int i = 0; i < UDP_BATCH; i++)
+    {
+        requestVecs[i] = { &requests[i], sizeof(udpRequest) };
+        received[i].msg_hdr.msg_iov = &requestVecs[i];
+        received[i].msg_hdr.msg_iovlen = 1;
+        received[i].msg_hdr.msg_name = &addresses[i];
+
+        responseVecs[i][0] = { &responses[i], sizeof(udpResponse) };
+        responseVecs[i][1] = { &payloads[i][0], 0 };
+        answers[i].msg_hdr.msg_iov = responseVecs[i].data();
+        answers[i].msg_hdr.msg_iovlen = 2;
+    }
+
+    while(true)
+    {
+        for(auto& message : received)
+            message.msg_hdr.msg_namelen = sizeof(sockaddr_storage);
+
+        // block for the first datagram, then take whatever else is already queued. Only the udpRequest
+        // is copied out, MSG_TRUNC still reports the full length so the padding counts
+        int count = recvmmsg(udpID, received.data(), UDP_BATCH, MSG_WAITFORONE | MSG_TRUNC, nullptr);
+        if(count == 0 || stopRequested)
+            break; // ShutDown, a shut down socket keeps returning empty datagrams
+        if(count < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            std::cerr << "ERROR #" << errno << ": Receiving datagrams failed.\n";
             break;
         }
+        auto arrival = std::chrono::steady_clock::now();
+
+        int numAnswers = 0;
+        for(int i = 0; i < count; i++)
+        {
+            if(received[i].msg_len < sizeof(udpRequest))
+                continue; // not a request
+
+            const int selection = requests[i].selection;
+            int msgLen = ReadCached(msgBuffer, selection);
+            if(msgLen < 0)
+            {
+                // answered on its own from the pool so the rest of the batch doesn't wait
+                udpRequest request = requests[i];
+                size_t requestLength = received[i].msg_len;
+                sockaddr_storage address = addresses[i];
+                socklen_t addressLength = received[i].msg_hdr.msg_namelen;
+                AddJobs([this, udpID, request, requestLength, address, addressLength, arrival]()
+                {
+                    auto serviceStart = std::chrono::steady_clock::now();
+                    std::array<char, 1024 * 32> output;
+                    int msgLen = SelectCommand(output, request.selection);
+
+                    udpResponse response = { request.tag, 0 };
+                    char payload[UDP_MAX_PAYLOAD];
+                    iovec vecs[2] = { { &response, sizeof(response) },
+                                      { payload, FillDatagram(response, payload, output, msgLen, requestLength) } };
+                    msghdr message;
+                    memset(&message, 0, sizeof(message));
+                    message.msg_name = const_cast<sockaddr_storage*>(&address);
+                    message.msg_namelen = addressLength;
+                    message.msg_iov = vecs;
+                    message.msg_iovlen = 2;
+                    sendmsg(udpID, &message, 0);
+
+                    if(m_Tracer)
+                        m_Tracer->Record(request.selection, arrival, serviceStart, std::chrono::steady_clock::now());
+                }, IsCheap(selection) ? LANE_CHEAP : LANE_EXPENSIVE);
+                continue;
+            }
+
+            responses[numAnswers] = { requests[i].tag, 0 };
+            responseVecs[numAnswers][1].iov_len = FillDatagram(responses[numAnswers], &payloads[numAnswers][0], msgBuffer, msgLen,
+                                                               received[i].msg_len);
+            answers[numAnswers].msg_hdr.msg_name = &addresses[i];
+            answers[numAnswers].msg_hdr.msg_namelen = received[i].msg_hdr.msg_namelen;
+            selections[numAnswers] = selection;
+            numAnswers++;
+        }
+
+        // a full socket buffer can take only part of the batch, the rest is dropped like any lost datagram
+        for(int sent = 0; sent < numAnswers; )
+        {
+            int numSent = sendmmsg(udpID, &answers[sent], numAnswers - sent, 0);
+            if(numSent <= 0)
+                break;
+            sent += numSent;
+        }
+
+        if(m_Tracer)
+        {
+            auto done = std::chrono::steady_clock::now();
+            for(int i = 0; i < numAnswers; i++)
+                m_Tracer->Record(selections[i], arrival, arrival, done);
+        }
     }
 }
 
-void Server::HandleCommand(std::array<char, 1024 * 32>& msgBuffer, std::string command)
+size_t Server::FillDatagram(udpResponse& response, char* payload, const std::array<char, 1024 * 32>& msgBuffer, int msgLen,
+                            size_t requestLength)
 {
-    // get the buffer ready for output
+    if(size_t(msgLen) > UDP_MAX_PAYLOAD || sizeof(udpResponse) + msgLen > requestLength)
+    {
+        // too big for one datagram or for the request, the client asks for it over TCP on the same port
+        response.length = UDP_REDIRECT;
+        return 0;
+    }
+
+    response.length = msgLen;
+    memcpy(payload, &msgBuffer[0], msgLen);
+    return msgLen;
+}
+
+int Server::SelectCommand(std::array<char, 1024 * 32>& msgBuffer, int userSelection)
+{
+    if(userSelection < 1 || userSelection > SHARED_NUM_SLOTS)
+    {
+        snprintf(&msgBuffer[0], msgBuffer.size() - 1, "ERROR: invalid selection.");
+        return strlen(&msgBuffer[0]);
+    }
+
+    // on a stale slot only one process on the host ends up running the command
+    if(m_SharedCache)
+    {
+        return m_SharedCache->Read(userSelection - 1, &msgBuffer[0], msgBuffer.size(),
+            [this, userSelection](char* buffer, size_t size)
+            {
+                std::array<char, 1024 * 32> output;
+                HandleCommand(output, userSelection);
+                memcpy(buffer, &output[0], std::min(size, output.size()));
+            });
+    }
+
+    cacheEntry& entry = m_Nodes[currentNode]->cache[userSelection - 1];
+    {
+        std::unique_lock<std::mutex> lock(entry.lock);
+        while(true)
+        {
+            // serve the cache if it is less than a second old, or stale while someone else refreshes it
+            bool fresh = std::chrono::steady_clock::now() - entry.timePoint < CACHE_TTL;
+            if(entry.valid && (fresh || entry.refreshing))
+            {
+                memcpy(&msgBuffer[0], &entry.msgBuffer[0], entry.length + 1);
+                return entry.length;
+            }
+
+            if(!entry.refreshing)
+                break;
+
+            // nothing to serve yet, wait for the first output
+            entry.filled.wait(lock);
+        }
+        entry.refreshing = true;
+    }
+
+    return RefreshEntry(msgBuffer, userSelection);
+}
+
+int Server::ReadCached(std::array<char, 1024 * 32>& msgBuffer, int userSelection)
+{
+    // an invalid selection is only the error message
+    if(userSelection < 1 || userSelection > SHARED_NUM_SLOTS)
+        return SelectCommand(msgBuffer, userSelection);
+
+    if(m_SharedCache)
+        return m_SharedCache->ReadFresh(userSelection - 1, &msgBuffer[0], msgBuffer.size());
+
+    cacheEntry& entry = m_Nodes[currentNode]->cache[userSelection - 1];
+    std::lock_guard<std::mutex> lock(entry.lock);
+    if(!entry.valid || std::chrono::steady_clock::now() - entry.timePoint >= CACHE_TTL)
+        return -1;
+
+    memcpy(&msgBuffer[0], &entry.msgBuffer[0], entry.length + 1);
+    return entry.length;
+}
+
+int Server::RefreshEntry(std::array<char, 1024 * 32>& msgBuffer, int userSelection)
+{
+    // run the command without holding the entry lock
+    HandleCommand(msgBuffer, userSelection);
+    int msgLen = strnlen(&msgBuffer[0], msgBuffer.size() - 1);
+
+    cacheEntry& entry = m_Nodes[currentNode]->cache[userSelection - 1];
     {
-        std::lock_guard<std::mutex> lock (m_MsgLock);
-        snprintf(&msgBuffer[0], msgBuffer.size() - 1, command.c_str());
-        memset(&msgBuffer[0] + command.size() + 1, '\0', msgBuffer.size() - command.size() - 1);
+        std::lock_guard<std::mutex> lock(entry.lock);
+        memcpy(&entry.msgBuffer[0], &msgBuffer[0], msgLen);
+        entry.msgBuffer[msgLen] = '\0';
+        entry.length = msgLen;
+        entry.timePoint = std::chrono::steady_clock::now();
+        entry.valid = true;
+        entry.refreshing = false;
+    }
+    entry.filled.notify_all();
 
+    return msgLen;
+}
 
-        GetCommandOutput(msgBuffer);
+void Server::WarmCache()
+{
+    std::array<bool, SHARED_NUM_SLOTS> loaded = {};
+    if(!m_Options.snapshotPath.empty())
+        loaded = LoadSnapshot();
+
+    // the shared cache is the same for every node so it only needs warming once
+    const int numNodes = m_SharedCache ? 1 : int(m_Nodes.size());
+
+    std::vector<std::thread> producers;
+    for(int node = 0; node < numNodes; node++)
+    {
+        for(int selection = 1; selection <= SHARED_NUM_SLOTS; selection++)
+        {
+            if(loaded[selection - 1])
+            {
+                // already servable, revalidate in the background while we start listening
+                AddJobs([this, selection]()
+                {
+                    std::array<char, 1024 * 32> msgBuffer;
+                    RefreshEntry(msgBuffer, selection);
+                }, LANE_CHEAP, node);
+                continue;
+            }
+
+            producers.emplace_back([this, node, selection]()
+            {
+                currentNode = node;
+                if(m_Options.numa)
+                    pinThread(pthread_self(), m_Nodes[node]->cpus);
+
+                std::array<char, 1024 * 32> msgBuffer;
+                SelectCommand(msgBuffer, selection);
+            });
+        }
     }
+
+    for(auto& t : producers)
+        t.join();
+}
+
+std::array<bool, SHARED_NUM_SLOTS> Server::LoadSnapshot()
+{
+    std::array<bool, SHARED_NUM_SLOTS> loaded = {};
+
+    int fd = open(m_Options.snapshotPath.c_str(), O_RDONLY);
+    if(fd < 0)
+        return loaded; // first start, nothing to load
+
+    struct stat info;
+    const size_t expectedSize = sizeof(snapshotHeader) + sizeof(snapshotEntry) * SHARED_NUM_SLOTS;
+    if(fstat(fd, &info) < 0 || size_t(info.st_size) != expectedSize)
+    {
+        std::cerr << "Ignoring snapshot " << m_Options.snapshotPath << ", unexpected size.\n";
+        close(fd);
+        return loaded;
+    }
+
+    void* addr = mmap(nullptr, expectedSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(addr == MAP_FAILED)
+        return loaded;
+
+    const snapshotHeader* header = static_cast<const snapshotHeader*>(addr);
+    const snapshotEntry* entries = reinterpret_cast<const snapshotEntry*>(header + 1);
+    if(header->magic == SNAPSHOT_MAGIC && header->numEntries == SHARED_NUM_SLOTS && header->entrySize == sizeof(snapshotEntry))
+    {
+        auto now = std::chrono::system_clock::now().time_since_epoch();
+        for(int i = 0; i < SHARED_NUM_SLOTS; i++)
+        {
+            const snapshotEntry& saved = entries[i];
+            auto age = now - std::chrono::nanoseconds(saved.wallTime);
+            if(saved.length < 0 || size_t(saved.length) >= sizeof(saved.data) || age > SNAPSHOT_MAX_AGE)
+                continue;
+
+            // mark it stale and refreshing so it gets served while the background refresh runs
+            for(auto& node : m_Nodes)
+            {
+                cacheEntry& entry = node->cache[i];
+                std::lock_guard<std::mutex> lock(entry.lock);
+                memcpy(&entry.msgBuffer[0], saved.data, saved.length);
+                entry.msgBuffer[saved.length] = '\0';
+                entry.length = saved.length;
+                entry.timePoint = std::chrono::steady_clock::now() - CACHE_TTL;
+                entry.valid = true;
+                entry.refreshing = true;
+            }
+            loaded[i] = true;
+        }
+    }
+    else
+        std::cerr << "Ignoring snapshot " << m_Options.snapshotPath << ", incompatible layout.\n";
+
+    munmap(addr, expectedSize);
+    return loaded;
+}
+
+void Server::SaveSnapshot()
+{
+    // write to a temporary file first so a crash never leaves a torn snapshot behind
+    std::string tmpPath = m_Options.snapshotPath + ".tmp";
+    FILE* fp = fopen(tmpPath.c_str(), "wb");
+    if(!fp)
+    {
+        std::cerr << "ERROR #" << errno << ": Writing the snapshot failed.\n";
+        return;
+    }
+
+    snapshotHeader header = { SNAPSHOT_MAGIC, SHARED_NUM_SLOTS, sizeof(snapshotEntry) };
+    fwrite(&header, sizeof(header), 1, fp);
+
+    auto steadyNow = std::chrono::steady_clock::now();
+    auto wallNow = std::chrono::system_clock::now();
+    std::unique_ptr<snapshotEntry> saved = std::make_unique<snapshotEntry>();
+    for(cacheEntry& entry : m_Nodes[0]->cache)
+    {
+        memset(saved.get(), 0, sizeof(snapshotEntry));
+        {
+            std::lock_guard<std::mutex> lock(entry.lock);
+            if(entry.valid)
+            {
+                auto produced = wallNow - (steadyNow - entry.timePoint);
+                saved->wallTime = std::chrono::duration_cast<std::chrono::nanoseconds>(produced.time_since_epoch()).count();
+                saved->length = entry.length;
+                memcpy(saved->data, &entry.msgBuffer[0], entry.length);
+            }
+            else
+                saved->length = -1;
+        }
+        fwrite(saved.get(), sizeof(snapshotEntry), 1, fp);
+    }
+
+    bool failed = ferror(fp);
+    failed |= fclose(fp) != 0;
+    if(failed || rename(tmpPath.c_str(), m_Options.snapshotPath.c_str()) < 0)
+        std::cerr << "ERROR #" << errno << ": Writing the snapshot failed.\n";
+}
+
+bool Server::IsCheap(int userSelection)
+{
+    // invalid selections are only an error message
+    if(userSelection < 1 || userSelection > SHARED_NUM_SLOTS)
+        return true;
+
+    if(m_SharedCache)
+    {
+        if(m_SharedCache->IsFresh(userSelection - 1))
+            return true;
+    }
+    else
+    {
+        cacheEntry& entry = m_Nodes[currentNode]->cache[userSelection - 1];
+        std::lock_guard<std::mutex> lock(entry.lock);
+        bool fresh = std::chrono::steady_clock::now() - entry.timePoint < CACHE_TTL;
+        if(entry.valid && (fresh || entry.refreshing))
+            return true;
+    }
+
+    return m_CommandCost[userSelection - 1].micro.load(std::memory_order_relaxed) < CHEAP_COST_MICRO;
+}
+
+void Server::HandleCommand(std::array<char, 1024 * 32>& msgBuffer, int userSelection)
+{
+    std::string command = COMMANDS[userSelection - 1];
+
+    // get the buffer ready for output
+    snprintf(&msgBuffer[0], msgBuffer.size() - 1, "%s", command.c_str());
+    memset(&msgBuffer[0] + command.size() + 1, '\0', msgBuffer.size() - command.size() - 1);
+
+    auto start = std::chrono::steady_clock::now();
+    GetCommandOutput(msgBuffer);
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+
+    // moving average with a weight of 1/8 for the new sample, the first sample seeds it
+    std::atomic<int64_t>& cost = m_CommandCost[userSelection - 1].micro;
+    int64_t average = cost.load(std::memory_order_relaxed);
+    int64_t updated = average == 0 ? elapsed.count() : average + (elapsed.count() - average) / 8;
+    cost.store(updated, std::memory_order_relaxed);
 }
 
 void Server::GetCommandOutput(std::array<char, 1024 * 32>& msgBuffer)
 {
+    char* start = &msgBuffer[0];
+    if(m_Spawner)
+    {
+        // the command is sent to the helper before its output overwrites it, without helpers it is still there
+        int length = m_Spawner->Run(start, start, msgBuffer.size());
+        if(length >= 0)
+            return;
+        if(length != SPAWN_NO_HELPER)
+        {
+            snprintf(start, msgBuffer.size(), "ERROR: could not execuite command");
+            return;
+        }
+    }
+
     FILE* fp;
     {
-        char* start = &msgBuffer[0];
         fp = popen(start, "r");
         if(!fp)
         {
@@ -203,4 +1467,4 @@ void Server::GetCommandOutput(std::array<char, 1024 * 32>& msgBuffer)
         fread(start, sizeof(char), msgBuffer.size() - 1,  fp);
     }
     pclose(fp); 
-}
\ No newline at end of file
+}
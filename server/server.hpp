@@ -3,12 +3,21 @@
 
 #include <sys/socket.h> // socket(), listen()
 #include <sys/types.h> // Recommended by man page
-#include <netinet/in.h> // sockaddr_in
+#include <netinet/in.h> // sockaddr_in, sockaddr_in6
+#include <netinet/tcp.h> // TCP_NODELAY
+#include <sys/un.h> // sockaddr_un
+#include <sys/epoll.h> // idle keep-alive connections
+#include <sys/timerfd.h> // idle connection sweeps
+#include <sys/uio.h> // iovec, sendmsg() framed responses
 #include <stdlib.h> // exit()
 #include <stdio.h> // fgets()
 #include <unistd.h> // read()
 #include <string.h> // memset(), memcpy()
 #include <errno.h> // errno error code
+#include <signal.h> // sigaction(), graceful shutdown
+#include <fcntl.h> // open()
+#include <sys/mman.h> // mmap() snapshot file
+#include <sys/stat.h> // fstat()
 #include <thread> // multithreading
 #include <vector> // threadpool
 #include <chrono> // timer
@@ -16,10 +25,23 @@
 #include <queue> // job queue
 #include <functional> // function pointers
 #include <condition_variable> // conditional vars for yielding threads
+#include <atomic> // cost averages
+#include <memory> // unique_ptr
+#include <string>
+#include <deque> // writers waiting on a multiplexed connection
+#include <unordered_map> // multiplexed connections by fd
 
 #include <iostream>
 #include <array>
 
+#include "sharedcache.hpp"
+#include "topology.hpp"
+#include "eventloop.hpp"
+#include "task.hpp"
+#include "tracer.hpp"
+#include "shmring.hpp"
+#include "spawnpool.hpp"
+
 /**
  * The CHK_ERR macro is used to use preprocessor to write the socket error checking code by 
  * wrapping the first argument up in an if and second argument to output error message.
@@ -34,6 +56,195 @@
     exit(0);\
 }\
 
+/**
+ * The number of spawn helpers forked when --spawn-helpers isn't given. Each helper runs one command at a time,
+ * so this is how many cache misses can run their commands at once.
+ */
+constexpr int DEFAULT_SPAWN_HELPERS = 6;
+
+/**
+ * The serverOptions struct holds the optional features of the server which are set from the command line.
+ * The defaults are the original single process behaviour.
+ */
+struct serverOptions {
+
+    bool sharedCache = false; // share the command cache with the other server processes on this host
+    std::string sharedCacheName = "/cnt4504_cache";
+    bool reusePort = false; // let several server processes listen on the same port
+    std::string snapshotPath; // warm cache file written at shut down and loaded at start up, empty to disable
+    bool pinCpus = false; // pin every worker to its own core
+    bool numa = false; // one job queue and cache per NUMA node, workers stay on their node
+    int eventLoops = 0; // serve connections from coroutines on this many event loops, 0 for blocking workers
+    std::string tracePath; // record every request to this binary trace file, empty to disable
+    std::string unixPath; // also listen on this Unix domain socket, empty to disable
+    std::string ringName; // serve same host clients through this shared memory ring, needs sharedCache
+    int udpThreads = 0; // answer datagrams on the same port with this many threads, 0 to disable
+    int spawnHelpers = DEFAULT_SPAWN_HELPERS; // processes forked at start up to run the commands, 0 to popen from the workers
+};
+
+/**
+ * The scheduling lanes of the thread pool. Requests that are expected to be answered from the cache or whose
+ * command is cheap to run go in the cheap lane, cache misses of expensive commands go in the expensive lane.
+ * The expensive lane can never occupy every worker so cheap requests don't queue behind ps or netstat.
+ */
+constexpr int LANE_CHEAP = 0;
+constexpr int LANE_EXPENSIVE = 1;
+constexpr int NUM_LANES = 2;
+
+/**
+ * A client that sets KEEP_ALIVE_FLAG in its selection asks the server to leave the connection open after the
+ * response so it can send the next selection on it. Legacy selections 1 - 6 never have it set and are closed.
+ */
+constexpr int KEEP_ALIVE_FLAG = 0x100;
+
+/**
+ * The datagram protocol. A request is a udpRequest, the tag is chosen by the client and echoed back so it can
+ * match answers to requests with many in flight. An answer is a udpResponse followed by length bytes of output.
+ * An output bigger than UDP_MAX_PAYLOAD isn't split, the length is UDP_REDIRECT and the client asks over TCP.
+ * The answer is never bigger than the request, so a spoofed source address can't be used to amplify traffic:
+ * a client pads its request with zeros after the udpRequest, and an output that doesn't fit in the answer
+ * the padding pays for is redirected as well. Padding to UDP_MAX_PAYLOAD bytes lets every output that fits
+ * a datagram come back in one.
+ */
+struct udpRequest {
+
+    int32_t selection;
+    uint32_t tag;
+};
+
+struct udpResponse {
+
+    uint32_t tag;
+    int32_t length;
+};
+
+constexpr int32_t UDP_REDIRECT = -1;
+constexpr size_t UDP_MAX_PAYLOAD = 1400; // keeps an answer in one unfragmented datagram on an Ethernet MTU
+
+/**
+ * The multiplexed protocol. Instead of a selection a client opens the connection with a muxHello holding the
+ * highest version it speaks, "CNT" followed by the version byte never reads as a legacy selection. The server
+ * answers with a muxAccept holding the version both speak and how many requests may be in flight at once.
+ * From then on every request is a muxRequest and every answer a muxResponse followed by length bytes of output.
+ * Answers are sent as soon as their output is ready, so they come back in any order and the client matches
+ * them to its requests by id. The server stops reading a connection that has MUX_MAX_IN_FLIGHT unanswered,
+ * the blocking workers accept at most half as many as a node has workers.
+ */
+struct muxHello {
+
+    char magic[3]; // MUX_MAGIC
+    uint8_t version;
+};
+
+struct muxAccept {
+
+    muxHello hello;
+    uint32_t maxInFlight;
+};
+
+struct muxRequest {
+
+    uint32_t id;
+    int32_t selection;
+};
+
+struct muxResponse {
+
+    uint32_t id;
+    int32_t length;
+};
+
+constexpr char MUX_MAGIC[3] = { 'C', 'N', 'T' };
+constexpr uint8_t MUX_VERSION = 1;
+constexpr int MUX_MAX_IN_FLIGHT = 16;
+
+/**
+ * The muxConnection struct is the state of a multiplexed connection served by the blocking workers. Only one
+ * worker reads it at a time as the fd is one shot in the idle set, the answers are written by whichever worker
+ * produced them. The fd is closed once the reader dropped the connection and the last answer is written.
+ */
+struct muxConnection {
+
+    int clientID;
+    std::mutex lock; // guards the in flight count and the flags
+    int inFlight = 0;
+    bool paused = false; // the reader stopped at the limit, the next answer re-arms the fd
+    bool closed = false;
+    std::mutex writeLock; // keeps the frames of concurrent answers from interleaving
+    char partial[sizeof(muxRequest)]; // the start of a request split over two reads
+    size_t partialBytes = 0;
+
+    ~muxConnection() { close(clientID); }
+};
+
+/**
+ * The muxSession struct is the state of a multiplexed connection served on an event loop. The reading coroutine
+ * owns it, the coroutines answering its requests take turns writing and wake the reader when they are done.
+ */
+struct muxSession {
+
+    EventLoop& loop;
+    int clientID;
+    int writeID; // a dup of clientID, so a blocked writer and the reader are separate epoll registrations
+    int inFlight = 0;
+    bool writing = false;
+    std::deque<std::coroutine_handle<>> writers; // waiting for their turn to write
+    std::coroutine_handle<> reader; // waiting for a request to finish
+    bool broken = false;
+
+    muxSession(EventLoop& loop, int clientID, int writeID) : loop(loop), clientID(clientID), writeID(writeID) {}
+};
+
+/**
+ * The cacheEntry struct holds the cached output of a single command. A stale output keeps being served
+ * while one thread runs the command again, the other requests only wait when there is no output at all yet.
+ * Entries start on their own cache line so the lock of one command never shares a line with another's output.
+ */
+struct alignas(CACHE_LINE_SIZE) cacheEntry {
+
+    std::mutex lock;
+    std::condition_variable filled; // signalled when a refresh finishes
+    bool valid = false; // msgBuffer holds an output that can be served
+    bool refreshing = false; // a thread is currently running the command
+    int length = 0;
+    std::chrono::time_point<std::chrono::steady_clock> timePoint;
+    std::array<char, 1024 * 32> msgBuffer;
+};
+
+/**
+ * The jobQueue struct is the scheduling state of the thread pool. It is only ever touched with the lock held,
+ * so it is kept together on its own cache lines, away from the read mostly configuration of the server.
+ */
+struct alignas(CACHE_LINE_SIZE) jobQueue {
+
+    std::mutex lock;
+    std::condition_variable condition;
+    std::array<std::queue<std::function<void()>>, NUM_LANES> lanes;
+    int cheapStreak = 0; // cheap jobs dequeued since the last expensive one
+    int expensiveRunning = 0;
+    int maxExpensive = 0; // workers the expensive lane may occupy at once
+};
+
+/**
+ * The workerNode struct groups the workers of one NUMA node with the job queue and cache they use, so
+ * a request is queued, served and cached by the same node. Without --numa there is a single node.
+ */
+struct workerNode {
+
+    std::vector<int> cpus;
+    jobQueue queue;
+    std::array<cacheEntry, SHARED_NUM_SLOTS> cache;
+};
+
+/**
+ * The commandCost struct is the moving average cost of one command, padded to a cache line as the
+ * averages are updated by whichever worker ran the command.
+ */
+struct alignas(CACHE_LINE_SIZE) commandCost {
+
+    std::atomic<int64_t> micro{0};
+};
+
 class Server 
 {
 public:
@@ -41,11 +252,13 @@ public:
     /**
      * The Server constructor is responsible for setting up the socket and listening to said socket.
      * The moment that the server object gets created and constructor is called is the when the server will attempt
-     * to open socket, bind ip, listen on socket.
+     * to open socket, bind ip, listen on socket. Every command's cache is filled before the socket starts
+     * listening, either from the snapshot file or by running all the commands in parallel.
      * 
      * @param port
+     * @param options
      */
-    Server(int port);
+    Server(int port, const serverOptions& options = serverOptions());
 
     /**
      * The Server destructor is a default destructor and accepts no arguments.
@@ -57,7 +270,8 @@ public:
     // Public methods
     /**
      * The AcceptCons method will loop and accept incoming connections to the open port 
-     * that the server is listening to. It will run indefinitely until closed manually.
+     * that the server is listening to. It will run until the process receives SIGINT or SIGTERM.
+     * With event loops enabled the connections are accepted and served by coroutines instead.
      * The method accepts no arguments and returns nothing.
      *
      * @param void 
@@ -68,37 +282,77 @@ public:
     /**
      * AddJobs is a method that will add a job (new connection) to the job queue.
      * The method will accept a function pointer of type void(int) and will add an incoming
-     * connection to the thread pool's job queue. The method returns nothing.
+     * connection to the given lane of the thread pool's job queue. The method returns nothing.
      * Code was inspired by the thread pool implementation from Anthony William's "C++ Concurreny in Action"
      * 
      * @param  std::function<void()> f
+     * @param  lane  -  LANE_CHEAP or LANE_EXPENSIVE.
+     * @param  node  -  The node whose queue gets the job, -1 for the node of the calling thread.
      * @return void
      */
-    void AddJobs(std::function<void()> f);
+    void AddJobs(std::function<void()> f, int lane = LANE_CHEAP, int node = -1);
 
     /**
      * GetJobs is the method that will loop the threads until they get assigned a job.
      * The thread pool's thread use this to check if there are jobs in the job queue.
-     * The function accepts no arguments and returns nothing.
+     * The lanes are dequeued weighted fair, CHEAP_WEIGHT cheap jobs for every expensive one,
+     * and expensive jobs are only started while a worker stays free for the cheap lane.
+     * The function accepts the worker's node and returns nothing.
      * Code was inspired by the thread pool implementation from Anthony William's "C++ Concurreny in Action"
      * 
-     * @param  void
+     * @param  node  -  The node the worker belongs to.
      * @return void
      */
-    void GetJobs();
+    void GetJobs(int node);
 
     /**
      * The HandleConn method will be used when calling a new thread. It will handle a new connection
-     * and call the necessary functions so that it functions as intended. The method will terminate the connection
-     * and the thread once it has finished the job.
+     * and call the necessary functions so that it functions as intended. Once the selection is read the
+     * request is answered right away if it is cheap, otherwise it is moved to the expensive lane.
+     * It is also called when an idle keep-alive connection has its next selection ready. A connection that
+     * opens with a muxHello switches to the multiplexed protocol, its later requests are read by ReadFrames.
+     *
+     * @param  clientID  -  The file descriptor of the newly opened or readable connection.
+     * @param  arrival   -  When the connection was accepted, used for the trace.
+     * @return void
+     */
+    void HandleConn(int clientID, std::chrono::steady_clock::time_point arrival);
+
+    /**
+     * The SendResponse method answers a request whose selection has been read. It terminates the connection
+     * unless the client asked for keep-alive, then the connection goes back to the idle set.
+     *
+     * @param  clientID
+     * @param  userSelection
+     * @param  arrival
+     * @param  keepAlive
+     * @return void
+     */
+    void SendResponse(int clientID, int userSelection, std::chrono::steady_clock::time_point arrival, bool keepAlive);
+
+    /**
+     * The ReadFrames method reads the requests a multiplexed connection has ready, up to its in flight limit.
+     * Cheap requests are answered right away, the others are moved to the expensive lane. The connection goes
+     * back to the idle set unless it is at the limit or the client hung up.
      *
-     * @param  clientID  -  The file descriptor of the newly opened connection.
+     * @param  conn
      * @return void
      */
-    void HandleConn(int clientID);
+    void ReadFrames(const std::shared_ptr<muxConnection>& conn);
+
+    /**
+     * The SendFrame method answers one request of a multiplexed connection and frees its in flight slot.
+     *
+     * @param  conn
+     * @param  request
+     * @param  arrival  -  When the request was read, used for the trace.
+     * @return void
+     */
+    void SendFrame(const std::shared_ptr<muxConnection>& conn, muxRequest request, std::chrono::steady_clock::time_point arrival);
 
     /**
      * The ShutDown method will close the open fds and handle any memory cleanup
+     * and writes the cache snapshot if one was configured.
      * The method accepts no arguments and returns nothing.
      * 
      * @param void
@@ -109,31 +363,214 @@ public:
 private:
     // Private member methods
     /**
-     * The SelectCommand method will be responsible for determining the request and calling the appropriate
-     * bash command. The function will accept a message buffer, and user's selection as arguments and returns nothing.
+     * The RunEventLoops method starts the event loops, each accepting from the shared listening sockets,
+     * and waits for SIGINT or SIGTERM before stopping them.
+     *
+     * @param  void
+     * @return void
+     */
+    void RunEventLoops();
+
+    /**
+     * The AcceptLoop coroutine accepts connections on an event loop and spawns a HandleConnAsync for each.
+     *
+     * @param  loop
+     * @param  listenID  -  The TCP or the Unix domain listening socket.
+     * @return Task<>
+     */
+    Task<> AcceptLoop(EventLoop& loop, int listenID);
+
+    /**
+     * The ExpireIdleAsync coroutine runs on every event loop and shuts down the connections that have been
+     * waiting for their next request for longer than the idle timeout.
+     *
+     * @param  loop
+     * @return Task<>
+     */
+    Task<> ExpireIdleAsync(EventLoop& loop);
+
+    /**
+     * The HandleConnAsync coroutine is HandleConn written against the event loop. Requests with a fresh
+     * cached output are answered on the loop, the others are run on the thread pool in their cost lane and the
+     * coroutine picks up again on its loop once the output is ready. A keep-alive connection is served by the same coroutine until
+     * the client closes it.
+     *
+     * @param  loop
+     * @param  clientID
+     * @param  arrival
+     * @return Task<>
+     */
+    Task<> HandleConnAsync(EventLoop& loop, int clientID, std::chrono::steady_clock::time_point arrival);
+
+    /**
+     * The ServeMuxAsync coroutine serves a connection that opened with a muxHello. It reads requests while
+     * fewer than MUX_MAX_IN_FLIGHT are unanswered and spawns a ServeFrameAsync for each. It returns once the
+     * client hung up and every answer is written, the caller closes the connection.
+     *
+     * @param  loop
+     * @param  clientID
+     * @param  hello
+     * @return Task<>
+     */
+    Task<> ServeMuxAsync(EventLoop& loop, int clientID, muxHello hello);
+
+    /**
+     * The ServeFrameAsync coroutine answers one request of a multiplexed connection, independent of the
+     * requests before it, so a cheap answer overtakes an expensive one still running on the thread pool.
+     *
+     * @param  session
+     * @param  request
+     * @param  arrival
+     * @return Task<>
+     */
+    Task<> ServeFrameAsync(muxSession& session, muxRequest request, std::chrono::steady_clock::time_point arrival);
+
+    /**
+     * The ServeRing method runs on its own thread and answers the requests of the shared memory ring until
+     * ShutDown stops it. A request is complete once its shared cache slot is fresh, stale slots are refreshed
+     * on the thread pool in their cost lane, the ring thread itself never runs a command.
+     *
+     * @param  void
+     * @return void
+     */
+    void ServeRing();
+
+    /**
+     * The ServeDatagrams method runs on its own thread per datagram socket until ShutDown shuts the socket down.
+     * It drains up to a batch of requests with recvmmsg, answers the ones with a fresh cached output and sends
+     * all the answers with one sendmmsg. Cache misses are answered on their own from the thread pool.
+     *
+     * @param  udpID  -  The thread's datagram socket.
+     * @return void
+     */
+    void ServeDatagrams(int udpID);
+
+    /**
+     * The FillDatagram method turns an output into a datagram answer, or into a redirect if it doesn't fit
+     * in one or would make the answer bigger than the request. It returns the number of payload bytes to send
+     * after the header.
+     *
+     * @param  response
+     * @param  payload        -  At least UDP_MAX_PAYLOAD bytes.
+     * @param  msgBuffer
+     * @param  msgLen
+     * @param  requestLength  -  The size of the datagram that asked, padding included.
+     * @return size_t
+     */
+    size_t FillDatagram(udpResponse& response, char* payload, const std::array<char, 1024 * 32>& msgBuffer, int msgLen,
+                        size_t requestLength);
+
+    /**
+     * The RearmIdle method puts a connection back in the idle set so a worker picks it up once it is readable.
+     * It returns false if the connection couldn't be watched.
+     *
+     * @param  clientID
+     * @return bool
+     */
+    bool RearmIdle(int clientID);
+
+    /**
+     * The ExpireIdle method runs on the accepting thread when the sweep timer fires. It shuts down the connections
+     * that have been in the idle set for longer than the idle timeout, the worker woken by the hang up closes them.
+     * A multiplexed connection with answers still in flight isn't idle and is left alone.
+     *
+     * @param  void
+     * @return void
+     */
+    void ExpireIdle();
+
+    /**
+     * The SelectCommand method will be responsible for determining the request and copying the cached
+     * output of the appropriate bash command, running it first if the cache is empty or stale.
+     * The function will accept a message buffer, and user's selection as arguments and returns the output length.
+     * 
+     * @param msgBuffer
+     * @param userSelection
+     * @return int
+     */
+    int SelectCommand(std::array<char, 1024 * 32>& msgBuffer, int userSelection);
+
+    /**
+     * The ReadCached method copies the output of a selection into the message buffer if its cache entry is
+     * fresh and returns the length, or -1 if answering it means running the command or waiting for it.
+     * The event loops, the ring and the datagram threads only answer a request themselves if this succeeds.
      * 
      * @param msgBuffer
      * @param userSelection
+     * @return int
+     */
+    int ReadCached(std::array<char, 1024 * 32>& msgBuffer, int userSelection);
+
+    /**
+     * The RefreshEntry method runs the command of a selection and stores the output in its cache entry.
+     * The caller must have marked the entry as refreshing. The output is also left in the message buffer.
+     * 
+     * @param msgBuffer
+     * @param userSelection
+     * @return int
+     */
+    int RefreshEntry(std::array<char, 1024 * 32>& msgBuffer, int userSelection);
+
+    /**
+     * The StartWorkers method creates the nodes and the thread pool. Workers are pinned to their node's
+     * CPUs with --numa and to a single core each with --pin-cpus.
+     * 
+     * @param void
      * @return void
      */
-    void SelectCommand(std::array<char, 1024 * 32>& msgBuffer, int userSelection);
+    void StartWorkers();
 
     /**
-     * The HandleCommand method will check to see if the given command is already cached,
-     * if not it will get the correct output and push it to the cache before returning.
-     * The method accepts two arguments, a message buffer and a command. The method
+     * The WarmCache method fills every command's cache before the server starts listening. Outputs found in
+     * the snapshot are served straight away and revalidated on the thread pool, the rest get produced in parallel.
+     * 
+     * @param void
+     * @return void
+     */
+    void WarmCache();
+
+    /**
+     * The LoadSnapshot method maps the snapshot file and copies every recent enough output into the cache.
+     * It returns which selections were loaded, indexed by selection - 1.
+     * 
+     * @param void
+     * @return std::array<bool, SHARED_NUM_SLOTS>
+     */
+    std::array<bool, SHARED_NUM_SLOTS> LoadSnapshot();
+
+    /**
+     * The SaveSnapshot method writes the cache to the snapshot file so the next start up is already warm.
+     * 
+     * @param void
+     * @return void
+     */
+    void SaveSnapshot();
+
+    /**
+     * The IsCheap method predicts whether answering a selection is cheap. It is if the output can be served
+     * from the cache, or if the moving average cost of running the command is below CHEAP_COST_MICRO.
+     *
+     * @param  userSelection
+     * @return bool
+     */
+    bool IsCheap(int userSelection);
+
+    /**
+     * The HandleCommand method will get the buffer ready and call GetCommandOutput to get the
+     * output of the selection's command. It times the command and updates the moving average cost
+     * of the selection. The method accepts two arguments, a message buffer and a selection. The method
      * return nothing.
      * 
      * @param  msgBuffer
-     * @param  command
+     * @param  userSelection
      * @return void
      */
-    void HandleCommand(std::array<char, 1024 * 32>& msgBuffer, std::string command);
+    void HandleCommand(std::array<char, 1024 * 32>& msgBuffer, int userSelection);
 
     /**
-     * The GetCommandOutput method will be calling the popen function to invoke a terminal command and get
-     * the output back. It accepts a message buffer as an argument and returns nothing. It will return the ouput via
-     * the referenced message buffer.
+     * The GetCommandOutput method will be running the command in one of the spawn helpers and get the output back,
+     * it only calls popen if the server was started without helpers or all of them have died. It accepts a message buffer holding the
+     * command as an argument and returns nothing. It will return the ouput via the referenced message buffer.
      * 
      * @param msgBuffer
      * @return void
@@ -144,27 +581,46 @@ private:
 private:
     // Private member variables //
 
-    // Socket and msgBuffer
+    // Socket, read only once constructed apart from the client address used by the accepting thread
     int m_PortNumber;
+    serverOptions m_Options;
 
     int m_ServerID, m_NumBytes;
+    int m_UnixID = -1; // Unix domain listening socket, -1 unless --unix was given
+    int m_IdleID = -1; // epoll set of the listening sockets and the idle keep-alive connections
+    int m_SweepID = -1; // timer in the idle set that expires the connections idle for too long
     socklen_t m_ClientAddrLength;
-    sockaddr_in m_ServerAddress, m_ClientAddress;
-    std::array<char, 1024 * 32> m_MsgBuffer;
+    sockaddr_storage m_ServerAddress, m_ClientAddress; // IPv6 dual stack when the host supports it, else IPv4
+    int m_NextNode = 0; // round robin of new connections over the nodes
+
+    // per node job queues and command caches, each node is a separate allocation
+    std::vector<std::unique_ptr<workerNode>> m_Nodes;
+    std::unique_ptr<SharedCache> m_SharedCache;
+    std::unique_ptr<SpawnPool> m_Spawner;
+    std::unique_ptr<Tracer> m_Tracer;
+    std::unique_ptr<RequestRing> m_Ring;
+    std::thread m_RingThread;
+    std::vector<int> m_UdpIDs; // one datagram socket per thread, sharing the port with SO_REUSEPORT
+    std::vector<std::thread> m_UdpThreads;
+
+    // the event loops outlive their threads, jobs still on the thread pool post back to them until it is joined
+    std::vector<std::unique_ptr<EventLoop>> m_Loops;
+
+    // multiplexed connections served by the blocking workers, by fd
+    std::mutex m_MuxLock;
+    std::unordered_map<int, std::shared_ptr<muxConnection>> m_MuxConns;
+    int m_MuxInFlight = MUX_MAX_IN_FLIGHT; // requests a blocking multiplexed connection may have unanswered
+
+    // connections armed in the idle set and since when, removed by the accepting thread once it hands them out
+    std::mutex m_IdleLock;
+    std::unordered_map<int, std::chrono::steady_clock::time_point> m_IdleSince;
 
-    // thread locks and cache timings
-    int m_LastSelection = 0;
-    std::mutex m_MsgLock;
-    std::mutex m_TimePointLock;
-    std::chrono::time_point<std::chrono::steady_clock> m_TimePoint;
+    // exponential moving average of each command's run time in microseconds
+    std::array<commandCost, SHARED_NUM_SLOTS> m_CommandCost;
 
     // Thread pool 
-    bool m_Running = true;
-    std::mutex m_QueueLock;
-    std::mutex m_PoolLock;
-    std::condition_variable m_JobCondition;
+    alignas(CACHE_LINE_SIZE) std::atomic<bool> m_Running{true};
     std::vector<std::thread> m_ThreadPool;
-    std::queue<std::function<void()>> m_JobQueue;
 
 };
 
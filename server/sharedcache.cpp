@@ -0,0 +1,234 @@
+#include "sharedcache.hpp"
+#include "server.hpp" // CHK_ERR
+
+namespace
+{
+    constexpr uint32_t SEGMENT_MAGIC = 0x434e5431; // "CNT1"
+    constexpr uint32_t SEGMENT_INITIALIZING = 1; // claimed, the layout fields are being written
+
+    // a process that claimed the segment and didn't publish within this window died doing it
+    constexpr int INIT_WAIT_MILLI = 1000;
+
+    // a segment replaced this often and still rejected is recreated by another build at the same time
+    constexpr int ATTACH_ATTEMPTS = 3;
+
+    // a refresher that hasn't published within this window is presumed dead
+    constexpr int64_t LEASE_NANO = 5'000'000'000;
+}
+
+SharedCache::SharedCache(const std::string& name, int ttlMilli)
+    : m_Name(name), m_TTL(int64_t(ttlMilli) * 1'000'000)
+{
+    // a segment left behind by an older build, or by a process that died while claiming it, would
+    // otherwise keep every later server from starting
+    for(int attempt = 1; !Attach(); attempt++)
+    {
+        if(attempt == ATTACH_ATTEMPTS)
+        {
+            std::cerr << "ERROR: shared cache " << m_Name << " has an incompatible layout.\n";
+            exit(0);
+        }
+        std::cerr << "Recreating shared cache " << m_Name << ", the existing one has an incompatible layout.\n";
+        Unlink();
+    }
+}
+
+bool SharedCache::Attach()
+{
+    m_ShmID = shm_open(m_Name.c_str(), O_CREAT | O_RDWR, 0660);
+    CHK_ERR(m_ShmID, "Opening the shared cache")
+
+    // a new object is empty, every process sizes it the same so whoever gets there first
+    // simply creates the zero filled layout
+    struct stat info;
+    CHK_ERR(fstat(m_ShmID, &info), "Checking the shared cache")
+    if(size_t(info.st_size) != sizeof(SharedSegment) && info.st_size != 0)
+        return false;
+    CHK_ERR(ftruncate(m_ShmID, sizeof(SharedSegment)), "Sizing the shared cache")
+
+    void* addr = mmap(nullptr, sizeof(SharedSegment), PROT_READ | PROT_WRITE, MAP_SHARED, m_ShmID, 0);
+    if(addr == MAP_FAILED)
+    {
+        std::cerr << "ERROR #" << errno << ": Mapping the shared cache failed.\n";
+        exit(0);
+    }
+    m_Segment = static_cast<SharedSegment*>(addr);
+
+    // claim the segment layout if nobody has yet, the magic is published last so no other process
+    // can see it before the layout fields are written
+    uint32_t magic = 0;
+    if(m_Segment->magic.compare_exchange_strong(magic, SEGMENT_INITIALIZING, std::memory_order_acquire))
+    {
+        m_Segment->version = SEGMENT_VERSION;
+        m_Segment->slotSize = SHARED_SLOT_SIZE;
+        m_Segment->magic.store(SEGMENT_MAGIC, std::memory_order_release);
+        return true;
+    }
+
+    // otherwise wait for whoever claimed it to finish and make sure the layout matches ours
+    for(int waited = 0; magic == SEGMENT_INITIALIZING && waited < INIT_WAIT_MILLI; waited++)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        magic = m_Segment->magic.load(std::memory_order_acquire);
+    }
+    if(magic == SEGMENT_MAGIC && m_Segment->version == SEGMENT_VERSION && m_Segment->slotSize == SHARED_SLOT_SIZE)
+        return true;
+
+    munmap(m_Segment, sizeof(SharedSegment));
+    m_Segment = nullptr;
+    return false;
+}
+
+void SharedCache::Unlink()
+{
+    // only unlink the object we rejected, another process may have replaced it already
+    struct stat rejected, current;
+    int currentID = shm_open(m_Name.c_str(), O_RDONLY, 0);
+    if(currentID >= 0)
+    {
+        if(fstat(m_ShmID, &rejected) == 0 && fstat(currentID, &current) == 0 && rejected.st_ino == current.st_ino)
+            shm_unlink(m_Name.c_str());
+        close(currentID);
+    }
+
+    close(m_ShmID);
+    m_ShmID = -1;
+}
+
+SharedCache::~SharedCache()
+{
+    munmap(m_Segment, sizeof(SharedSegment));
+    close(m_ShmID);
+}
+
+int SharedCache::Read(int slotIndex, char* buffer, size_t size, const std::function<void(char*, size_t)>& producer)
+{
+    CacheSlot& slot = m_Segment->slots[slotIndex];
+    size = std::min(size, SHARED_SLOT_SIZE);
+
+    while(true)
+    {
+        uint32_t length = 0;
+        int64_t timeStamp = 0;
+        while(!TryRead(slot, buffer, size, length, timeStamp))
+            ; // writer was mid publish, try again
+
+        // if the slot is still fresh we are done without touching the kernel
+        int64_t now = Now();
+        if(timeStamp != 0 && now - timeStamp < m_TTL)
+            return length;
+
+        if(TryAcquireLease(slot, now))
+        {
+            // someone may have published between our read and winning the lease
+            uint32_t freshLength = 0;
+            int64_t freshStamp = 0;
+            if(TryRead(slot, buffer, size, freshLength, freshStamp) && freshStamp != 0 && Now() - freshStamp < m_TTL)
+            {
+                slot.refresher.store(0, std::memory_order_relaxed);
+                slot.leaseExpiry.store(0, std::memory_order_release);
+                return freshLength;
+            }
+
+            memset(buffer, '\0', size);
+            producer(buffer, size);
+            length = strnlen(buffer, size - 1);
+            Publish(slot, buffer, length);
+
+            slot.refresher.store(0, std::memory_order_relaxed);
+            slot.leaseExpiry.store(0, std::memory_order_release);
+            return length;
+        }
+
+        // another process is refreshing, serve the stale output if we have one
+        if(timeStamp != 0)
+            return length;
+
+        // the slot was never filled, wait for the refresher to publish unless it died holding the lease
+        if(!ReleaseDeadLease(slot))
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+int SharedCache::ReadFresh(int slotIndex, char* buffer, size_t size)
+{
+    CacheSlot& slot = m_Segment->slots[slotIndex];
+    size = std::min(size, SHARED_SLOT_SIZE);
+
+    uint32_t length = 0;
+    int64_t timeStamp = 0;
+    while(!TryRead(slot, buffer, size, length, timeStamp))
+        ; // writer was mid publish, try again
+
+    return timeStamp != 0 && Now() - timeStamp < m_TTL ? int(length) : -1;
+}
+
+bool SharedCache::IsFresh(int slotIndex)
+{
+    int64_t timeStamp = m_Segment->slots[slotIndex].timeStamp.load(std::memory_order_relaxed);
+    return timeStamp != 0 && Now() - timeStamp < m_TTL;
+}
+
+bool SharedCache::TryRead(CacheSlot& slot, char* buffer, size_t size, uint32_t& length, int64_t& timeStamp)
+{
+    uint32_t before = slot.sequence.load(std::memory_order_acquire);
+    if(before & 1)
+        return false;
+
+    length = std::min<uint32_t>(slot.length.load(std::memory_order_relaxed), size - 1);
+    timeStamp = slot.timeStamp.load(std::memory_order_relaxed);
+    memcpy(buffer, slot.data, length);
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if(slot.sequence.load(std::memory_order_relaxed) != before)
+        return false;
+
+    buffer[length] = '\0';
+    return true;
+}
+
+void SharedCache::Publish(CacheSlot& slot, const char* buffer, uint32_t length)
+{
+    // take the write side of the seqlock, a lease that expired under a slow
+    // producer can leave two writers so they still have to exclude each other
+    uint32_t seq = slot.sequence.load(std::memory_order_relaxed);
+    while((seq & 1) || !slot.sequence.compare_exchange_weak(seq, seq + 1, std::memory_order_acquire))
+        seq = slot.sequence.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    memcpy(slot.data, buffer, length);
+    slot.length.store(length, std::memory_order_relaxed);
+    slot.timeStamp.store(Now(), std::memory_order_relaxed);
+
+    slot.sequence.store(seq + 2, std::memory_order_release);
+}
+
+bool SharedCache::TryAcquireLease(CacheSlot& slot, int64_t now)
+{
+    int64_t expiry = slot.leaseExpiry.load(std::memory_order_acquire);
+    if(expiry > now)
+        return false;
+
+    if(!slot.leaseExpiry.compare_exchange_strong(expiry, now + LEASE_NANO, std::memory_order_acq_rel))
+        return false;
+
+    slot.refresher.store(getpid(), std::memory_order_relaxed);
+    return true;
+}
+
+bool SharedCache::ReleaseDeadLease(CacheSlot& slot)
+{
+    int64_t expiry = slot.leaseExpiry.load(std::memory_order_acquire);
+    int32_t holder = slot.refresher.load(std::memory_order_relaxed);
+    if(expiry == 0 || holder <= 0 || kill(holder, 0) == 0 || errno != ESRCH)
+        return false;
+
+    // only the lease we looked at, a live process may have taken a new one since
+    return slot.leaseExpiry.compare_exchange_strong(expiry, 0, std::memory_order_acq_rel);
+}
+
+int64_t SharedCache::Now()
+{
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+}
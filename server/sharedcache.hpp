@@ -0,0 +1,203 @@
+#ifndef SHAREDCACHE_HPP
+#define SHAREDCACHE_HPP
+
+#include <sys/mman.h> // shm_open(), mmap()
+#include <sys/stat.h> // mode constants
+#include <fcntl.h> // O_* constants
+#include <unistd.h> // ftruncate(), getpid()
+#include <stdint.h> // fixed width integers
+#include <string.h> // memcpy()
+#include <errno.h> // errno error code
+#include <signal.h> // kill() to check on a refresher
+#include <atomic> // seqlock counters
+#include <chrono> // slot time stamps
+#include <thread> // sleep while the first refresh runs
+#include <algorithm> // std::min
+#include <string>
+#include <functional> // producer callback
+
+/**
+ * The size of a single cached response, this matches the size of the server's message buffer
+ * so a slot can always be copied into it.
+ */
+constexpr size_t SHARED_SLOT_SIZE = 1024 * 32;
+
+/**
+ * The number of slots in the segment, one per selectable command.
+ */
+constexpr int SHARED_NUM_SLOTS = 6;
+
+/**
+ * The version of the segment layout, bumped whenever SharedSegment or CacheSlot change.
+ */
+constexpr uint32_t SEGMENT_VERSION = 2;
+
+/**
+ * The CacheSlot struct is the layout of a single cached command output inside the shared memory segment.
+ * Readers use the sequence number as a seqlock: an odd sequence means a writer is publishing and the
+ * copy has to be retried. The lease is used to elect a single refresher process for the slot.
+ * Every field is valid when zero filled so a freshly truncated segment needs no initialization.
+ */
+struct CacheSlot {
+
+    std::atomic<uint32_t> sequence;
+    std::atomic<uint32_t> length;
+    std::atomic<int64_t> timeStamp; // steady clock ns, 0 if never filled
+    std::atomic<int64_t> leaseExpiry; // steady clock ns, refresher owns slot until then
+    std::atomic<int32_t> refresher; // pid of the elected refresher, 0 while nobody refreshes
+    char data[SHARED_SLOT_SIZE];
+};
+
+/**
+ * The SharedSegment struct is the full layout of the shared memory object. The magic number, version and
+ * slot size are used to detect a segment left behind by a build with a different layout. The magic is
+ * written after the other header fields so a process that sees it can trust them.
+ */
+struct SharedSegment {
+
+    std::atomic<uint32_t> magic;
+    uint32_t version;
+    uint32_t slotSize;
+    alignas(64) CacheSlot slots[SHARED_NUM_SLOTS];
+};
+
+/**
+ * The SharedCache class wraps a POSIX shared memory segment that holds a time-based cache of the command
+ * outputs which can be shared between several server processes on the same host. Reading a fresh slot
+ * takes no locks and makes no system calls. When a slot goes stale one process wins the lease and refreshes it
+ * while the others keep serving the old output, so the command only gets run once per TTL per host.
+ */
+class SharedCache
+{
+public:
+    /**
+     * The SharedCache constructor opens (or creates) the shared memory object with the given name and maps it.
+     * An object with another layout, or one whose creator died before publishing the layout, is unlinked
+     * and created again. The time to live is how old a slot can get before it has to be refreshed.
+     *
+     * @param name       -  The name of the shared memory object, must start with '/'.
+     * @param ttlMilli   -  The time to live of every slot in milliseconds.
+     */
+    SharedCache(const std::string& name, int ttlMilli);
+
+    /**
+     * The SharedCache destructor unmaps the segment. The shared memory object itself is left
+     * in place for the other server processes.
+     *
+     * @param void
+     */
+    ~SharedCache();
+
+    SharedCache(const SharedCache&) = delete;
+    SharedCache& operator=(const SharedCache&) = delete;
+
+    /**
+     * The Read method copies the cached output of a slot into the given buffer and returns its length.
+     * If the slot is stale and this process wins the refresher election, the producer gets called to
+     * fill the buffer and the result is published to the other processes.
+     *
+     * @param  slot      -  The index of the slot to read.
+     * @param  buffer    -  The buffer the output gets copied into.
+     * @param  size      -  The size of the buffer, at most SHARED_SLOT_SIZE bytes are used.
+     * @param  producer  -  Callback that fills the buffer with a fresh output.
+     * @return int       -  The number of bytes copied.
+     */
+    int Read(int slot, char* buffer, size_t size, const std::function<void(char*, size_t)>& producer);
+
+    /**
+     * The ReadFresh method copies the output of a slot into the buffer if it is younger than the time to live
+     * and returns its length. It returns -1 for a stale or empty slot, it never runs the producer or waits.
+     *
+     * @param  slot
+     * @param  buffer
+     * @param  size
+     * @return int
+     */
+    int ReadFresh(int slot, char* buffer, size_t size);
+
+    /**
+     * The IsFresh method checks if a slot holds an output younger than the time to live.
+     *
+     * @param  slot
+     * @return bool
+     */
+    bool IsFresh(int slot);
+
+private:
+    /**
+     * TryRead makes a single attempt at a consistent copy of the slot. It returns false if a writer
+     * was publishing during the copy.
+     *
+     * @param  slot
+     * @param  buffer
+     * @param  size
+     * @param  length     -  Set to the number of bytes copied.
+     * @param  timeStamp  -  Set to the time the slot was filled.
+     * @return bool
+     */
+    bool TryRead(CacheSlot& slot, char* buffer, size_t size, uint32_t& length, int64_t& timeStamp);
+
+    /**
+     * Publish writes a new output into the slot using the seqlock.
+     *
+     * @param  slot
+     * @param  buffer
+     * @param  length
+     * @return void
+     */
+    void Publish(CacheSlot& slot, const char* buffer, uint32_t length);
+
+    /**
+     * TryAcquireLease elects this process as the refresher of the slot if no other live lease exists.
+     *
+     * @param  slot
+     * @param  now
+     * @return bool
+     */
+    bool TryAcquireLease(CacheSlot& slot, int64_t now);
+
+    /**
+     * ReleaseDeadLease drops the lease of a slot whose refresher process has exited without publishing,
+     * so the readers waiting for a first output don't have to wait for the lease to expire.
+     * It returns true if the lease was dropped.
+     *
+     * @param  slot
+     * @return bool
+     */
+    bool ReleaseDeadLease(CacheSlot& slot);
+
+    /**
+     * Attach opens the shared memory object, creating and sizing it if it is new, maps it and checks the layout.
+     * It returns false if the object has another layout, the fd is kept open for Unlink.
+     *
+     * @param  void
+     * @return bool
+     */
+    bool Attach();
+
+    /**
+     * Unlink removes the shared memory object Attach rejected, unless another process already replaced it.
+     * The processes still mapping it keep their mapping.
+     *
+     * @param  void
+     * @return void
+     */
+    void Unlink();
+
+    /**
+     * Now returns the current steady clock time in nanoseconds. The steady clock is CLOCK_MONOTONIC
+     * which is shared by all the processes on the host.
+     *
+     * @param  void
+     * @return int64_t
+     */
+    static int64_t Now();
+
+private:
+    std::string m_Name;
+    int64_t m_TTL;
+    int m_ShmID = -1;
+    SharedSegment* m_Segment = nullptr;
+};
+
+#endif // SHAREDCACHE_HPP
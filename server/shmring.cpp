@@ -0,0 +1,141 @@
+#include "shmring.hpp"
+#include "server.hpp" // CHK_ERR
+
+#include <linux/futex.h> // FUTEX_WAIT, FUTEX_WAKE
+#include <sys/syscall.h> // SYS_futex
+#include <limits.h> // INT_MAX
+#include <signal.h> // kill()
+
+namespace
+{
+    // how often Pop looks at a cell that was claimed but not published yet
+    constexpr timespec CLAIM_POLL = {0, 10'000'000};
+
+    // a live client publishes right after claiming, a cell still unpublished after this was abandoned
+    // even if its claim was never recorded
+    constexpr auto CLAIM_TIMEOUT = std::chrono::seconds(1);
+
+    // the segment is shared between processes so the futexes can't use the private variants
+    void futexWait(std::atomic<uint32_t>& word, uint32_t expected, const timespec* timeout = nullptr)
+    {
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT, expected, timeout, nullptr, 0);
+    }
+
+    void futexWake(std::atomic<uint32_t>& word, int count)
+    {
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE, count, nullptr, nullptr, 0);
+    }
+}
+
+RequestRing::RequestRing(const std::string& name, const std::string& cacheName)
+    : m_Name(name)
+{
+    if(cacheName.size() >= sizeof(RingSegment::cacheName))
+    {
+        std::cerr << "ERROR: shared cache name " << cacheName << " is too long for the ring.\n";
+        exit(0);
+    }
+
+    // start from a fresh object, clients of a previous server may still have the old one mapped
+    shm_unlink(m_Name.c_str());
+    m_ShmID = shm_open(m_Name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0660);
+    CHK_ERR(m_ShmID, "Creating the request ring")
+    CHK_ERR(ftruncate(m_ShmID, sizeof(RingSegment)), "Sizing the request ring")
+
+    void* addr = mmap(nullptr, sizeof(RingSegment), PROT_READ | PROT_WRITE, MAP_SHARED, m_ShmID, 0);
+    if(addr == MAP_FAILED)
+    {
+        std::cerr << "ERROR #" << errno << ": Mapping the request ring failed.\n";
+        exit(0);
+    }
+    m_Segment = static_cast<RingSegment*>(addr);
+
+    // the truncated object is zero filled, only the cell tickets need a starting value
+    m_Segment->ringSize = RING_SIZE;
+    strncpy(m_Segment->cacheName, cacheName.c_str(), sizeof(m_Segment->cacheName) - 1);
+    for(uint32_t i = 0; i < RING_SIZE; i++)
+        m_Segment->cells[i].sequence.store(i, std::memory_order_relaxed);
+    m_Segment->magic.store(RING_MAGIC, std::memory_order_release);
+}
+
+RequestRing::~RequestRing()
+{
+    munmap(m_Segment, sizeof(RingSegment));
+    close(m_ShmID);
+    shm_unlink(m_Name.c_str());
+}
+
+bool RequestRing::Pop(uint32_t& position, int& selection)
+{
+    while(!m_Stopping.load(std::memory_order_relaxed))
+    {
+        uint32_t head = m_Segment->head.load(std::memory_order_relaxed);
+        ringCell& cell = m_Segment->cells[head % RING_SIZE];
+        if(cell.sequence.load(std::memory_order_acquire) == head + 1)
+        {
+            selection = cell.selection;
+            position = head;
+            m_Segment->head.store(head + 1, std::memory_order_relaxed);
+            return true;
+        }
+
+        // a client that died between claiming the cell and publishing it would hold up every request behind it,
+        // free the cell unless the client publishes in the meantime
+        bool claimed = m_Segment->tail.load() != head;
+        if(claimed && Abandoned(cell, head))
+        {
+            uint32_t expected = head;
+            if(cell.sequence.compare_exchange_strong(expected, head + RING_SIZE))
+            {
+                std::cout << "Skipped a request ring cell abandoned by its client.\n";
+                m_Segment->head.store(head + 1, std::memory_order_relaxed);
+            }
+            continue;
+        }
+
+        // announce that we are going to sleep before the last look, a client publishing after it sees the
+        // flag and wakes us, one publishing before it has already changed wakeSeq so the wait returns at once
+        m_Segment->serverSleeping.store(1);
+        uint32_t seen = m_Segment->wakeSeq.load();
+        if(cell.sequence.load() != head + 1 && !m_Stopping.load())
+            futexWait(m_Segment->wakeSeq, seen, claimed ? &CLAIM_POLL : nullptr);
+        m_Segment->serverSleeping.store(0, std::memory_order_relaxed);
+    }
+    return false;
+}
+
+bool RequestRing::Abandoned(ringCell& cell, uint32_t head)
+{
+    auto now = std::chrono::steady_clock::now();
+    if(m_StallHead != head || m_StallSince == std::chrono::steady_clock::time_point{})
+    {
+        m_StallHead = head;
+        m_StallSince = now;
+        return false;
+    }
+
+    // the client records its claim right after winning the cell, if it has we know exactly who to ask
+    uint64_t claim = cell.claim.load(std::memory_order_acquire);
+    pid_t owner = pid_t(uint32_t(claim));
+    if(uint32_t(claim >> 32) == head && owner > 0 && (kill(owner, 0) < 0 && errno == ESRCH))
+        return true;
+    return now - m_StallSince >= CLAIM_TIMEOUT;
+}
+
+void RequestRing::Complete(uint32_t position)
+{
+    ringCell& cell = m_Segment->cells[position % RING_SIZE];
+    cell.done.store(position + 1);
+    if(cell.waiting.exchange(0))
+        futexWake(cell.done, INT_MAX);
+
+    // the response lives in the shared cache, so the cell can be reused right away
+    cell.sequence.store(position + RING_SIZE, std::memory_order_release);
+}
+
+void RequestRing::Stop()
+{
+    m_Stopping = true;
+    m_Segment->wakeSeq.fetch_add(1);
+    futexWake(m_Segment->wakeSeq, 1);
+}
@@ -0,0 +1,127 @@
+#ifndef SHMRING_HPP
+#define SHMRING_HPP
+
+#include <sys/mman.h> // shm_open(), mmap()
+#include <sys/stat.h> // mode constants
+#include <fcntl.h> // O_* constants
+#include <unistd.h> // ftruncate(), syscall()
+#include <stdint.h> // fixed width integers
+#include <atomic>
+#include <chrono>
+#include <string>
+
+/**
+ * The number of requests that can be waiting in the ring, a power of two so positions wrap cleanly.
+ */
+constexpr uint32_t RING_SIZE = 256;
+
+/**
+ * The ringCell struct is one request in the ring. The sequence number works like a ticket: a producer may claim
+ * the cell for position p while sequence is p, it publishes the selection by setting p + 1 and the server
+ * frees the cell for position p + RING_SIZE once it is done. done is the futex word the client sleeps on.
+ * claim records who claimed the cell, so the server can give up on a client that died before publishing.
+ */
+struct alignas(64) ringCell {
+
+    std::atomic<uint32_t> sequence;
+    std::atomic<uint32_t> done; // p + 1 once the response for position p is in the shared cache
+    std::atomic<uint32_t> waiting; // set by a client going to sleep on done
+    int32_t selection;
+    std::atomic<uint64_t> claim; // p in the high half and the claiming client's pid in the low half
+};
+
+/**
+ * The RingSegment struct is the layout of the ring's shared memory object. The name of the shared cache holding
+ * the responses is part of it, so a client only needs to know the ring's name. The client keeps a copy of
+ * this layout, RING_MAGIC changes whenever it does.
+ */
+struct RingSegment {
+
+    std::atomic<uint32_t> magic; // written last, once the cells are initialized
+    uint32_t ringSize;
+    char cacheName[64];
+    alignas(64) std::atomic<uint32_t> tail; // next position a client claims
+    alignas(64) std::atomic<uint32_t> head; // next position the server takes, only the server writes it
+    std::atomic<uint32_t> wakeSeq; // futex word the server sleeps on, bumped by every request
+    std::atomic<uint32_t> serverSleeping;
+    ringCell cells[RING_SIZE];
+};
+
+constexpr uint32_t RING_MAGIC = 0x52494e32; // "RIN2"
+
+/**
+ * The RequestRing class is the server's end of the shared memory transport. Clients on the same host publish
+ * selections into the ring without a system call, the server makes sure the selection's shared cache slot
+ * is fresh and marks the request done, and the client copies the response straight out of the shared cache.
+ * Either side only enters the kernel to sleep or to wake a sleeper, through futexes in the segment.
+ */
+class RequestRing
+{
+public:
+    /**
+     * The RequestRing constructor creates the ring's shared memory object, replacing one left behind by a
+     * server that didn't shut down cleanly.
+     *
+     * @param name       -  The name of the shared memory object, must start with '/'.
+     * @param cacheName  -  The name of the shared cache the responses are read from.
+     */
+    RequestRing(const std::string& name, const std::string& cacheName);
+
+    /**
+     * The RequestRing destructor unmaps and removes the ring so new clients can't publish to it anymore.
+     *
+     * @param void
+     */
+    ~RequestRing();
+
+    RequestRing(const RequestRing&) = delete;
+    RequestRing& operator=(const RequestRing&) = delete;
+
+    /**
+     * Pop waits for the next request and returns its position and selection. It must only be called from one
+     * thread. It returns false once Stop was called. A cell whose client died between claiming and publishing
+     * it is skipped, so are cells claimed but left unpublished for longer than a live client ever takes.
+     *
+     * @param  position   -  Set to the position to hand to Complete.
+     * @param  selection  -  Set to the requested selection.
+     * @return bool
+     */
+    bool Pop(uint32_t& position, int& selection);
+
+    /**
+     * Complete tells the client of a request that its response is in the shared cache and frees the cell.
+     * It can be called from any thread and in any order.
+     *
+     * @param  position
+     * @return void
+     */
+    void Complete(uint32_t position);
+
+    /**
+     * Stop wakes the thread in Pop and makes it return false.
+     *
+     * @param  void
+     * @return void
+     */
+    void Stop();
+
+private:
+    /**
+     * Abandoned checks whether the claimed but unpublished cell at head will never be published, because
+     * its client is dead or it has been stuck for too long.
+     *
+     * @param  cell
+     * @param  head
+     * @return bool
+     */
+    bool Abandoned(ringCell& cell, uint32_t head);
+
+    std::string m_Name;
+    int m_ShmID;
+    RingSegment* m_Segment;
+    std::atomic<bool> m_Stopping{false};
+    uint32_t m_StallHead = 0; // the position Pop has been waiting to be published since m_StallSince
+    std::chrono::steady_clock::time_point m_StallSince{};
+};
+
+#endif // SHMRING_HPP
@@ -0,0 +1,254 @@
+#include "spawnpool.hpp"
+#include "server.hpp" // CHK_ERR
+
+#include <algorithm>
+
+namespace
+{
+    // output read from a command and sent to the server at once
+    constexpr size_t CHUNK_SIZE = 1024 * 16;
+
+    bool readExact(int fd, void* buffer, size_t size)
+    {
+        size_t total = 0;
+        while(total < size)
+        {
+            ssize_t numBytes = read(fd, static_cast<char*>(buffer) + total, size - total);
+            if(numBytes < 0 && errno == EINTR)
+                continue;
+            if(numBytes <= 0)
+                return false;
+            total += numBytes;
+        }
+        return true;
+    }
+
+    // a header and its bytes in one system call, a closed other end must not raise SIGPIPE in either process
+    bool sendFramed(int fd, const void* header, size_t headerSize, const void* data, size_t dataSize)
+    {
+        iovec iov[2] = { { const_cast<void*>(header), headerSize }, { const_cast<void*>(data), dataSize } };
+        msghdr message = {};
+        message.msg_iov = iov;
+        message.msg_iovlen = dataSize > 0 ? 2 : 1;
+        while(message.msg_iovlen > 0)
+        {
+            ssize_t numBytes = sendmsg(fd, &message, MSG_NOSIGNAL);
+            if(numBytes < 0 && errno == EINTR)
+                continue;
+            if(numBytes < 0)
+                return false;
+
+            while(message.msg_iovlen > 0 && size_t(numBytes) >= message.msg_iov->iov_len)
+            {
+                numBytes -= message.msg_iov->iov_len;
+                message.msg_iov++;
+                message.msg_iovlen--;
+            }
+            if(message.msg_iovlen > 0)
+            {
+                message.msg_iov->iov_base = static_cast<char*>(message.msg_iov->iov_base) + numBytes;
+                message.msg_iov->iov_len -= numBytes;
+            }
+        }
+        return true;
+    }
+
+    bool sendChunk(int fd, int32_t length, const char* data)
+    {
+        spawnChunk chunk = { length };
+        return sendFramed(fd, &chunk, sizeof(chunk), data, std::max(length, 0));
+    }
+}
+
+SpawnPool::SpawnPool(int numHelpers)
+{
+    for(int i = 0; i < numHelpers; i++)
+    {
+        int channel[2];
+        CHK_ERR(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, channel), "Creating a spawn helper channel")
+
+        pid_t pid = fork();
+        CHK_ERR(pid, "Forking a spawn helper")
+        if(pid == 0)
+        {
+            // the helper only keeps its own end, the other helpers have to see EOF once the server is gone
+            for(int channelID : m_Channels)
+                close(channelID);
+            close(channel[0]);
+            HelperMain(channel[1]);
+        }
+
+        close(channel[1]);
+        m_Helpers.push_back(pid);
+        m_Channels.push_back(channel[0]);
+    }
+
+    m_Idle = m_Channels;
+    m_Alive = numHelpers;
+}
+
+SpawnPool::~SpawnPool()
+{
+    for(int channelID : m_Channels)
+        close(channelID);
+    for(pid_t pid : m_Helpers)
+        waitpid(pid, nullptr, 0);
+}
+
+void SpawnPool::HelperMain(int channelID)
+{
+    // Ctrl-C reaches the whole process group, the server shuts its helpers down by closing the channels
+    signal(SIGINT, SIG_IGN);
+    signal(SIGTERM, SIG_IGN);
+
+    // the commands start with the default dispositions and nothing blocked, as they would from popen
+    sigset_t defaults, empty;
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGINT);
+    sigaddset(&defaults, SIGTERM);
+    sigemptyset(&empty);
+
+    posix_spawnattr_t attributes;
+    posix_spawnattr_init(&attributes);
+    posix_spawnattr_setsigdefault(&attributes, &defaults);
+    posix_spawnattr_setsigmask(&attributes, &empty);
+    posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK);
+
+    std::array<char, SPAWN_MAX_COMMAND + 1> command;
+    std::array<char, CHUNK_SIZE> output;
+    while(true)
+    {
+        spawnRequest request;
+        if(!readExact(channelID, &request, sizeof(request)) || request.length > SPAWN_MAX_COMMAND
+           || !readExact(channelID, &command[0], request.length))
+            break;
+        command[request.length] = '\0';
+
+        int outputPipe[2];
+        if(pipe2(outputPipe, O_CLOEXEC) < 0)
+        {
+            if(!sendChunk(channelID, SPAWN_FAILED, nullptr))
+                break;
+            continue;
+        }
+
+        // dup2 clears close on exec, so the command's stdout is the only end it inherits
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_adddup2(&actions, outputPipe[1], STDOUT_FILENO);
+
+        char shell[] = "sh", flag[] = "-c";
+        char* argv[] = { shell, flag, &command[0], nullptr };
+        pid_t pid;
+        int status = posix_spawn(&pid, "/bin/sh", &actions, &attributes, argv, environ);
+        posix_spawn_file_actions_destroy(&actions);
+        close(outputPipe[1]);
+
+        // stream the output as the command produces it
+        bool connected = true;
+        if(status == 0)
+        {
+            ssize_t numBytes;
+            while(connected && (numBytes = read(outputPipe[0], &output[0], output.size())) != 0)
+            {
+                if(numBytes > 0)
+                    connected = sendChunk(channelID, numBytes, &output[0]);
+                else if(errno != EINTR)
+                    break;
+            }
+        }
+
+        // closed before waiting, a command still writing to a server that went away gets SIGPIPE
+        close(outputPipe[0]);
+        if(status == 0)
+            waitpid(pid, nullptr, 0);
+        if(!connected || !sendChunk(channelID, status == 0 ? 0 : SPAWN_FAILED, nullptr))
+            break;
+    }
+
+    // skip the destructors of everything copied from the server
+    _exit(0);
+}
+
+int SpawnPool::Run(const char* command, char* buffer, size_t size)
+{
+    spawnRequest request = { uint32_t(strnlen(command, SPAWN_MAX_COMMAND + 1)) };
+    if(request.length > SPAWN_MAX_COMMAND)
+        return -1;
+
+    while(true)
+    {
+        int channelID = Acquire();
+        if(channelID < 0)
+            return SPAWN_NO_HELPER;
+
+        // read the whole stream even if the buffer is full, so the helper is ready for the next command
+        size_t total = 0;
+        bool started = true, intact = sendFramed(channelID, &request, sizeof(request), command, request.length);
+        std::array<char, CHUNK_SIZE> discard;
+        while(intact)
+        {
+            spawnChunk chunk;
+            if(!(intact = readExact(channelID, &chunk, sizeof(chunk))))
+                break;
+            if(chunk.length <= 0)
+            {
+                started = chunk.length == 0;
+                break;
+            }
+
+            size_t kept = std::min(size_t(chunk.length), size - 1 - total);
+            intact = readExact(channelID, buffer + total, kept);
+            total += kept;
+            for(size_t left = chunk.length - kept; intact && left > 0; )
+            {
+                size_t part = std::min(left, discard.size());
+                intact = readExact(channelID, &discard[0], part);
+                left -= part;
+            }
+        }
+
+        if(!intact)
+        {
+            // the helper died, its channel is out of step so it is dropped rather than given back
+            std::cerr << "ERROR: A spawn helper exited unexpectedly.\n";
+            {
+                std::lock_guard<std::mutex> lock(m_Lock);
+                if(--m_Alive == 0)
+                    std::cerr << "ERROR: Every spawn helper has exited, the commands are run with popen from now on.\n";
+            }
+            m_Released.notify_all();
+
+            // no output was written over the command yet, so another helper can still run it
+            if(total == 0)
+                continue;
+            buffer[total] = '\0';
+            return -1;
+        }
+
+        buffer[total] = '\0';
+        Release(channelID);
+        return started ? int(total) : -1;
+    }
+}
+
+int SpawnPool::Acquire()
+{
+    std::unique_lock<std::mutex> lock(m_Lock);
+    m_Released.wait(lock, [this]() { return !m_Idle.empty() || m_Alive == 0; });
+    if(m_Idle.empty())
+        return -1;
+
+    int channelID = m_Idle.back();
+    m_Idle.pop_back();
+    return channelID;
+}
+
+void SpawnPool::Release(int channelID)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_Lock);
+        m_Idle.push_back(channelID);
+    }
+    m_Released.notify_one();
+}
@@ -0,0 +1,111 @@
+#ifndef SPAWNPOOL_HPP
+#define SPAWNPOOL_HPP
+
+#include <sys/socket.h> // socketpair()
+#include <sys/wait.h> // waitpid()
+#include <spawn.h> // posix_spawn()
+#include <unistd.h> // fork(), close()
+#include <stdint.h> // fixed width integers
+#include <stddef.h> // size_t
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+/**
+ * The helper protocol. A request is a spawnRequest followed by length bytes of the command line. The helper
+ * answers with the output as a stream of spawnChunk headers each followed by length bytes, a chunk of length
+ * 0 ends the output and SPAWN_FAILED means the command couldn't be started.
+ */
+struct spawnRequest {
+
+    uint32_t length;
+};
+
+struct spawnChunk {
+
+    int32_t length;
+};
+
+constexpr int32_t SPAWN_FAILED = -1;
+constexpr int SPAWN_NO_HELPER = -2; // returned by Run once every helper died
+constexpr uint32_t SPAWN_MAX_COMMAND = 4096;
+
+/**
+ * The SpawnPool class runs the server's commands in small helper processes. The helpers are forked when the
+ * pool is created, which has to happen while the server is still a single thread with little memory mapped,
+ * so the server never forks again once it has workers and a cache: copying its page tables would stall every
+ * worker. A helper takes command lines over its end of a socketpair, starts each one with posix_spawn and
+ * streams the output back. A thread running a command borrows an idle helper and waits for one if all are busy.
+ */
+class SpawnPool
+{
+public:
+    /**
+     * The SpawnPool constructor forks the helpers. It exits if one can't be created.
+     *
+     * @param numHelpers
+     */
+    SpawnPool(int numHelpers);
+
+    /**
+     * The SpawnPool destructor closes the helpers' channels, which makes them exit, and reaps them.
+     *
+     * @param void
+     */
+    ~SpawnPool();
+
+    SpawnPool(const SpawnPool&) = delete;
+    SpawnPool& operator=(const SpawnPool&) = delete;
+
+    /**
+     * Run runs a command line with /bin/sh in a helper and copies its output into the buffer, truncated to
+     * size - 1 bytes and null terminated. It returns the length of the output, or -1 if the command couldn't
+     * be run. A helper found dead before it sent any output is dropped and the command goes to the next one.
+     * It returns SPAWN_NO_HELPER without touching the buffer once every helper died, so the caller
+     * can run the command itself. The command is sent before the output is written, so it may point into
+     * the buffer.
+     *
+     * @param command
+     * @param buffer
+     * @param size
+     * @return int
+     */
+    int Run(const char* command, char* buffer, size_t size);
+
+private:
+    /**
+     * HelperMain is the whole life of a helper process. It serves requests until the server closes the
+     * channel and never returns.
+     *
+     * @param channelID  -  The helper's end of the socketpair.
+     * @return void
+     */
+    [[noreturn]] static void HelperMain(int channelID);
+
+    /**
+     * Acquire takes an idle helper's channel, waiting until one is free. It returns -1 if every helper died.
+     *
+     * @param void
+     * @return int
+     */
+    int Acquire();
+
+    /**
+     * Release hands a helper's channel back once its output has been read.
+     *
+     * @param channelID
+     * @return void
+     */
+    void Release(int channelID);
+
+private:
+    std::vector<pid_t> m_Helpers;
+    std::vector<int> m_Channels; // the server's end of every helper's socketpair
+
+    std::mutex m_Lock;
+    std::condition_variable m_Released;
+    std::vector<int> m_Idle;
+    int m_Alive = 0; // helpers that haven't died, a dead one is never replaced as that would mean forking
+};
+
+#endif // SPAWNPOOL_HPP
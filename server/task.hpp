@@ -0,0 +1,230 @@
+#ifndef TASK_HPP
+#define TASK_HPP
+
+#include <coroutine> // coroutine_handle, suspend_always
+#include <exception> // std::terminate()
+#include <cstddef>
+#include <new> // ::operator new
+#include <utility> // std::exchange
+
+/**
+ * The FramePool class hands out the memory for coroutine frames. Frames are rounded up to a power of two
+ * size class and freed frames are kept on a per thread free list, so once a server has warmed up starting a
+ * connection's coroutine costs no heap allocation. Frames bigger than the largest class use the heap.
+ */
+class FramePool
+{
+public:
+    /**
+     * Allocate returns a block of at least the given size.
+     *
+     * @param  size
+     * @return void*
+     */
+    static void* Allocate(size_t size)
+    {
+        int sizeClass = SizeClass(size);
+        if(sizeClass < 0)
+            return ::operator new(size);
+
+        freeBlock*& head = FreeLists()[sizeClass];
+        if(head)
+            return std::exchange(head, head->next);
+
+        return ::operator new(size_t(MIN_BLOCK) << sizeClass);
+    }
+
+    /**
+     * Free puts a block back on the free list of the calling thread. The size has to be the one it was allocated with.
+     *
+     * @param  block
+     * @param  size
+     * @return void
+     */
+    static void Free(void* block, size_t size)
+    {
+        int sizeClass = SizeClass(size);
+        if(sizeClass < 0)
+        {
+            ::operator delete(block);
+            return;
+        }
+
+        freeBlock* freed = static_cast<freeBlock*>(block);
+        freed->next = FreeLists()[sizeClass];
+        FreeLists()[sizeClass] = freed;
+    }
+
+private:
+    struct freeBlock { freeBlock* next; };
+
+    static constexpr size_t MIN_BLOCK = 64;
+    static constexpr int NUM_CLASSES = 11; // 64 bytes up to 64 KiB, enough for a frame holding a message buffer
+
+    static int SizeClass(size_t size)
+    {
+        int sizeClass = 0;
+        while((MIN_BLOCK << sizeClass) < size)
+        {
+            if(++sizeClass == NUM_CLASSES)
+                return -1;
+        }
+        return sizeClass;
+    }
+
+    // hands the cached frames back to the heap when the thread exits
+    struct freeListSet {
+
+        freeBlock* heads[NUM_CLASSES] = {};
+        ~freeListSet()
+        {
+            for(freeBlock* head : heads)
+            {
+                while(head)
+                    ::operator delete(std::exchange(head, head->next));
+            }
+        }
+    };
+
+    static freeBlock** FreeLists()
+    {
+        static thread_local freeListSet freeLists;
+        return freeLists.heads;
+    }
+};
+
+template<typename T>
+class Task;
+
+namespace detail
+{
+    /**
+     * The promiseBase struct holds what every Task promise shares: the pooled frame allocation, lazy start
+     * and handing control back to whoever awaited the task once it finishes. A detached task has nobody
+     * waiting for it and frees its own frame.
+     */
+    struct promiseBase {
+
+        std::coroutine_handle<> continuation;
+        bool detached = false;
+
+        static void* operator new(size_t size) { return FramePool::Allocate(size); }
+        static void operator delete(void* frame, size_t size) { FramePool::Free(frame, size); }
+
+        std::suspend_always initial_suspend() noexcept { return {}; }
+
+        struct finalAwaiter {
+
+            bool await_ready() noexcept { return false; }
+
+            template<typename Promise>
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept
+            {
+                promiseBase& promise = handle.promise();
+                if(promise.detached)
+                {
+                    handle.destroy();
+                    return std::noop_coroutine();
+                }
+                return promise.continuation ? promise.continuation : std::noop_coroutine();
+            }
+
+            void await_resume() noexcept {}
+        };
+
+        finalAwaiter final_suspend() noexcept { return {}; }
+
+        // the server exits on errors instead of throwing, so an exception escaping a connection is a bug
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+}
+
+/**
+ * The Task class is the return type of the server's coroutines. A task does nothing until it is either
+ * awaited by another coroutine, which is resumed once the task finishes, or detached onto an event loop.
+ * co_await on a task returns the value it co_returned.
+ */
+template<typename T = void>
+class Task
+{
+public:
+    struct promise_type : detail::promiseBase {
+
+        T value{};
+
+        Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        void return_value(T result) { value = std::move(result); }
+    };
+
+    Task(Task&& other) noexcept : m_Handle(std::exchange(other.m_Handle, nullptr)) {}
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+    ~Task() { if(m_Handle) m_Handle.destroy(); }
+
+    bool await_ready() noexcept { return false; }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+    {
+        m_Handle.promise().continuation = awaiting;
+        return m_Handle;
+    }
+
+    T await_resume() { return std::move(m_Handle.promise().value); }
+
+    /**
+     * Detach gives up ownership of the coroutine, which then frees itself when it finishes.
+     * It returns the handle to resume to start the task.
+     *
+     * @param  void
+     * @return std::coroutine_handle<>
+     */
+    std::coroutine_handle<> Detach()
+    {
+        m_Handle.promise().detached = true;
+        return std::exchange(m_Handle, nullptr);
+    }
+
+private:
+    explicit Task(std::coroutine_handle<promise_type> handle) : m_Handle(handle) {}
+
+    std::coroutine_handle<promise_type> m_Handle;
+};
+
+template<>
+class Task<void>
+{
+public:
+    struct promise_type : detail::promiseBase {
+
+        Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        void return_void() {}
+    };
+
+    Task(Task&& other) noexcept : m_Handle(std::exchange(other.m_Handle, nullptr)) {}
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+    ~Task() { if(m_Handle) m_Handle.destroy(); }
+
+    bool await_ready() noexcept { return false; }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+    {
+        m_Handle.promise().continuation = awaiting;
+        return m_Handle;
+    }
+
+    void await_resume() {}
+
+    std::coroutine_handle<> Detach()
+    {
+        m_Handle.promise().detached = true;
+        return std::exchange(m_Handle, nullptr);
+    }
+
+private:
+    explicit Task(std::coroutine_handle<promise_type> handle) : m_Handle(handle) {}
+
+    std::coroutine_handle<promise_type> m_Handle;
+};
+
+#endif // TASK_HPP
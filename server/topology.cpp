@@ -0,0 +1,82 @@
+#include "topology.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+std::vector<int> getAllowedCpus()
+{
+    std::vector<int> cpus;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if(sched_getaffinity(0, sizeof(set), &set) < 0)
+        return cpus;
+
+    for(int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if(CPU_ISSET(cpu, &set))
+            cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+std::vector<std::vector<int>> getNumaNodes()
+{
+    std::vector<int> allowed = getAllowedCpus();
+    std::vector<std::vector<int>> nodes;
+
+    // node directories are numbered from zero without gaps on every kernel we care about
+    for(int node = 0; ; node++)
+    {
+        std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        if(!file)
+            break;
+
+        std::string list;
+        std::getline(file, list);
+
+        // drop the CPUs we aren't allowed on, and memory only nodes
+        std::vector<int> cpus;
+        for(int cpu : parseCpuList(list))
+        {
+            if(std::binary_search(allowed.begin(), allowed.end(), cpu))
+                cpus.push_back(cpu);
+        }
+        if(!cpus.empty())
+            nodes.push_back(cpus);
+    }
+
+    if(nodes.empty())
+        nodes.push_back(allowed);
+    return nodes;
+}
+
+std::vector<int> parseCpuList(const std::string& list)
+{
+    std::vector<int> cpus;
+    std::stringstream stream(list);
+    std::string range;
+
+    while(std::getline(stream, range, ','))
+    {
+        if(range.empty())
+            continue;
+
+        size_t dash = range.find('-');
+        int first = std::stoi(range.substr(0, dash));
+        int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+        for(int cpu = first; cpu <= last; cpu++)
+            cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+bool pinThread(pthread_t thread, const std::vector<int>& cpus)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for(int cpu : cpus)
+        CPU_SET(cpu, &set);
+
+    return pthread_setaffinity_np(thread, sizeof(set), &set) == 0;
+}
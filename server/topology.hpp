@@ -0,0 +1,50 @@
+#ifndef TOPOLOGY_HPP
+#define TOPOLOGY_HPP
+
+#include <sched.h> // sched_getaffinity(), cpu_set_t
+#include <pthread.h> // pthread_setaffinity_np()
+#include <string>
+#include <vector>
+
+/**
+ * The size of a cache line on the machines the server runs on. Hot state that different threads write to
+ * is aligned to it so unrelated threads don't bounce the same line between cores.
+ */
+constexpr size_t CACHE_LINE_SIZE = 64;
+
+/**
+ * getAllowedCpus returns the CPUs the process is allowed to run on, in ascending order.
+ * The function accepts no arguments.
+ *
+ * @param void
+ * @return std::vector<int>
+ */
+std::vector<int> getAllowedCpus();
+
+/**
+ * getNumaNodes reads the NUMA topology from sysfs and returns the allowed CPUs of every node that has any.
+ * Machines without NUMA information are reported as a single node holding all the allowed CPUs.
+ *
+ * @param void
+ * @return std::vector<std::vector<int>>
+ */
+std::vector<std::vector<int>> getNumaNodes();
+
+/**
+ * parseCpuList parses a kernel CPU list such as "0-3,8,10-11" into the CPU numbers it names.
+ *
+ * @param list
+ * @return std::vector<int>
+ */
+std::vector<int> parseCpuList(const std::string& list);
+
+/**
+ * pinThread restricts a thread to the given CPUs. It returns false if the kernel refused.
+ *
+ * @param thread
+ * @param cpus
+ * @return bool
+ */
+bool pinThread(pthread_t thread, const std::vector<int>& cpus);
+
+#endif // TOPOLOGY_HPP
@@ -0,0 +1,80 @@
+#include "tracer.hpp"
+#include "server.hpp" // CHK_ERR
+
+namespace
+{
+    // records kept in memory before they are written out
+    constexpr size_t BATCH_SIZE = 4096;
+
+    uint32_t toMicro(std::chrono::steady_clock::duration duration)
+    {
+        return uint32_t(std::chrono::duration_cast<std::chrono::microseconds>(duration).count());
+    }
+}
+
+Tracer::Tracer(const std::string& path)
+    : m_Start(std::chrono::steady_clock::now())
+{
+    m_File = fopen(path.c_str(), "wb");
+    if(!m_File)
+    {
+        std::cerr << "ERROR #" << errno << ": Opening the trace file failed.\n";
+        exit(0);
+    }
+
+    traceHeader header = { TRACE_MAGIC, sizeof(traceRecord) };
+    fwrite(&header, sizeof(header), 1, m_File);
+    m_Records.reserve(BATCH_SIZE);
+}
+
+Tracer::~Tracer()
+{
+    Flush();
+    fclose(m_File);
+}
+
+void Tracer::Record(int selection, std::chrono::steady_clock::time_point arrival,
+                    std::chrono::steady_clock::time_point serviceStart, std::chrono::steady_clock::time_point done)
+{
+    traceRecord record = {};
+    record.arrivalNano = std::chrono::duration_cast<std::chrono::nanoseconds>(arrival - m_Start).count();
+    record.queueMicro = toMicro(serviceStart - arrival);
+    record.serviceMicro = toMicro(done - serviceStart);
+    record.selection = selection;
+
+    std::vector<traceRecord> full;
+    {
+        std::lock_guard<std::mutex> lock(m_RecordLock);
+        m_Records.push_back(record);
+        if(m_Records.size() < BATCH_SIZE)
+            return;
+
+        // take the full batch and write it without blocking the other workers
+        full.reserve(BATCH_SIZE);
+        full.swap(m_Records);
+    }
+    WriteRecords(full);
+}
+
+void Tracer::Flush()
+{
+    std::vector<traceRecord> remaining;
+    {
+        std::lock_guard<std::mutex> lock(m_RecordLock);
+        remaining.swap(m_Records);
+    }
+    WriteRecords(remaining);
+
+    std::lock_guard<std::mutex> lock(m_FileLock);
+    fflush(m_File);
+}
+
+void Tracer::WriteRecords(const std::vector<traceRecord>& records)
+{
+    if(records.empty())
+        return;
+
+    std::lock_guard<std::mutex> lock(m_FileLock);
+    if(fwrite(records.data(), sizeof(traceRecord), records.size(), m_File) != records.size())
+        std::cerr << "ERROR #" << errno << ": Writing the trace failed.\n";
+}
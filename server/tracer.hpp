@@ -0,0 +1,98 @@
+#ifndef TRACER_HPP
+#define TRACER_HPP
+
+#include <stdio.h> // fopen(), fwrite()
+#include <stdint.h> // fixed width integers
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * The traceHeader struct starts every trace file. The client's replay mode reads the same layout.
+ */
+struct traceHeader {
+
+    uint32_t magic; // TRACE_MAGIC
+    uint32_t recordSize; // sizeof(traceRecord), lets a reader reject a file from another layout
+};
+
+/**
+ * The traceRecord struct is one request in a trace file. Arrivals are relative to the start of the trace
+ * so a replay can reproduce the original spacing of the requests.
+ */
+struct traceRecord {
+
+    int64_t arrivalNano; // when the connection was accepted
+    uint32_t queueMicro; // accepted until the worker started on the request
+    uint32_t serviceMicro; // started until the response was written
+    int32_t selection;
+    uint32_t reserved;
+};
+
+constexpr uint32_t TRACE_MAGIC = 0x54524331; // "TRC1"
+
+/**
+ * The Tracer class appends request records to a binary trace file. Records are gathered in memory and
+ * written in batches so recording costs a short critical section per request rather than a system call.
+ */
+class Tracer
+{
+public:
+    /**
+     * The Tracer constructor creates the trace file and writes its header. The trace starts at this moment.
+     *
+     * @param path
+     */
+    Tracer(const std::string& path);
+
+    /**
+     * The Tracer destructor writes the remaining records and closes the file.
+     *
+     * @param void
+     */
+    ~Tracer();
+
+    Tracer(const Tracer&) = delete;
+    Tracer& operator=(const Tracer&) = delete;
+
+    /**
+     * The Record method adds one request to the trace. It is safe to call from any thread.
+     *
+     * @param  selection
+     * @param  arrival       -  When the connection was accepted.
+     * @param  serviceStart  -  When a worker started answering it.
+     * @param  done          -  When the response was written.
+     * @return void
+     */
+    void Record(int selection, std::chrono::steady_clock::time_point arrival,
+                std::chrono::steady_clock::time_point serviceStart, std::chrono::steady_clock::time_point done);
+
+    /**
+     * The Flush method writes the records gathered so far to the file.
+     *
+     * @param  void
+     * @return void
+     */
+    void Flush();
+
+private:
+    /**
+     * WriteRecords writes a batch of records, serialized so batches from different threads don't interleave.
+     *
+     * @param  records
+     * @return void
+     */
+    void WriteRecords(const std::vector<traceRecord>& records);
+
+private:
+    std::chrono::steady_clock::time_point m_Start;
+    FILE* m_File;
+
+    std::mutex m_RecordLock;
+    std::vector<traceRecord> m_Records;
+
+    std::mutex m_FileLock;
+};
+
+#endif // TRACER_HPP